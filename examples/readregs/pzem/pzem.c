@@ -6,6 +6,8 @@
 #include <modbus.h>
 #include <unistd.h>
 
+#include "../tty_socket.h"
+
 /****************************************************************************/
 static int
 print_help(const char* app)
@@ -19,17 +21,103 @@ print_help(const char* app)
     printf("  --reset-energy            Reset the energy(Wh)\n");
     printf("  --set-id id               Set modbus address\n");
     printf("  --set-range code          Set the shun type\n");
+    printf("  --via-socket [path]       Go through tty_reader, default %s\n",
+           TTY_SOCKET_DEFAULT_PATH);
     return 0;
 }
 
 /****************************************************************************/
-int
-main(int argc, char** argv)
+static int
+read_regs(modbus_t* ctx, int sck, int id, int input, int address,
+          int count, uint16_t* regs)
+{
+    if (sck != -1)
+    {
+        return tty_socket_read_registers(sck, id, input ? 0x04 : 0x03,
+                                         address, count, regs);
+    }
+    if (input)
+    {
+        return modbus_read_input_registers(ctx, address, count, regs);
+    }
+    return modbus_read_registers(ctx, address, count, regs);
+}
+
+/****************************************************************************/
+static int
+write_reg(modbus_t* ctx, int sck, int id, int address, int value)
+{
+    if (sck != -1)
+    {
+        return tty_socket_write_register(sck, id, address, value);
+    }
+    return modbus_write_register(ctx, address, value);
+}
+
+/****************************************************************************/
+static void
+cleanup(modbus_t* ctx, int sck)
+{
+    if (sck != -1)
+    {
+        close(sck);
+    }
+    if (ctx != NULL)
+    {
+        modbus_free(ctx);
+    }
+}
+
+/****************************************************************************/
+static int
+init_rtu(modbus_t** actx, int pzem_id, int debug)
 {
     modbus_t* ctx;
     uint32_t response_sec;
     uint32_t response_usec;
     modbus_error_recovery_mode er_mode;
+    int error;
+
+    ctx = modbus_new_rtu("/dev/ttyUSB0", 9600, 'N', 8, 1);
+    if (ctx == NULL)
+    {
+        return 1;
+    }
+    printf("main: modbus_new_rtu ok\n");
+
+    if (debug)
+    {
+        error = modbus_set_debug(ctx, TRUE);
+        printf("modbus_set_debug error %d\n", error);
+    }
+
+    er_mode = MODBUS_ERROR_RECOVERY_LINK | MODBUS_ERROR_RECOVERY_PROTOCOL;
+    error = modbus_set_error_recovery(ctx, er_mode);
+    printf("modbus_set_error_recovery error %d\n", error);
+    error = modbus_set_slave(ctx, pzem_id);
+    printf("modbus_set_slave error %d pzem_id %d\n", error, pzem_id);
+    error = modbus_get_response_timeout(ctx,
+                                        &response_sec,
+                                        &response_usec);
+    printf("modbus_get_response_timeout error %d sec %d usec %d\n", error,
+           response_sec, response_usec);
+    error = modbus_connect(ctx);
+    if (error == -1)
+    {
+        printf("main: Connection failed: %s\n", modbus_strerror(errno));
+        modbus_free(ctx);
+        return 1;
+    }
+    printf("main: Connection ok\n");
+    *actx = ctx;
+    return 0;
+}
+
+/****************************************************************************/
+int
+main(int argc, char** argv)
+{
+    modbus_t* ctx;
     uint16_t registers[8];
     int error;
     int index;
@@ -41,6 +129,8 @@ main(int argc, char** argv)
     int reset_energy;
     int set_id;
     int set_range;
+    int sck;
+    const char* socket_path;
     uint8_t rsp[MODBUS_TCP_MAX_ADU_LENGTH];
 
     if (argc < 2)
@@ -56,6 +146,9 @@ main(int argc, char** argv)
     reset_energy = 0;
     set_id = 0;
     set_range = -1;
+    sck = -1;
+    ctx = NULL;
+    socket_path = NULL;
     for (index = 1; index < argc; index++)
     {
         if (strcmp(argv[index], "--id") == 0)
@@ -112,6 +205,15 @@ main(int argc, char** argv)
             index++;
             set_range = atoi(argv[index]);
         }
+        else if (strcmp(argv[index], "--via-socket") == 0)
+        {
+            socket_path = TTY_SOCKET_DEFAULT_PATH;
+            if ((index + 1 < argc) && (argv[index + 1][0] != '-'))
+            {
+                index++;
+                socket_path = argv[index];
+            }
+        }
         else
         {
             printf("unknown command line parameter\n");
@@ -122,63 +224,61 @@ main(int argc, char** argv)
     {
         loop_delay = 1;
     }
-    ctx = modbus_new_rtu("/dev/ttyUSB0", 9600, 'N', 8, 1);
-    if (ctx == NULL)
-    {
-        return 1;
-    }
-    printf("main: modbus_new_rtu ok\n");
-
-    if (debug)
+    if (socket_path != NULL)
     {
-        error = modbus_set_debug(ctx, TRUE);
-        printf("modbus_set_debug error %d\n", error);
+        sck = tty_socket_connect(socket_path);
+        if (sck == -1)
+        {
+            printf("main: tty_socket_connect %s failed: %s\n", socket_path,
+                   strerror(errno));
+            return 1;
+        }
+        printf("main: tty_socket_connect ok\n");
     }
-
-    er_mode = MODBUS_ERROR_RECOVERY_LINK | MODBUS_ERROR_RECOVERY_PROTOCOL;
-    error = modbus_set_error_recovery(ctx, er_mode);
-    printf("modbus_set_error_recovery error %d\n", error);
-    error = modbus_set_slave(ctx, pzem_id);
-    printf("modbus_set_slave error %d pzem_id %d\n", error, pzem_id);
-    error = modbus_get_response_timeout(ctx,
-                                        &response_sec,
-                                        &response_usec);
-    printf("modbus_get_response_timeout error %d sec %d usec %d\n", error,
-           response_sec, response_usec);
-    error = modbus_connect(ctx);
-    if (error == -1)
+    else
     {
-        printf("main: Connection failed: %s\n", modbus_strerror(errno));
-        modbus_free(ctx);
-        return 1;
+        error = init_rtu(&ctx, pzem_id, debug);
+        if (error != 0)
+        {
+            return error;
+        }
     }
-    printf("main: Connection ok\n");
     if (set_id > 0)
     {
-        modbus_write_register(ctx, 0x0002, set_id);
-        modbus_free(ctx);
+        write_reg(ctx, sck, pzem_id, 0x0002, set_id);
+        cleanup(ctx, sck);
         return 0;
     }
     if (set_range >= 0)
     {
-        modbus_write_register(ctx, 0x0003, set_range);
-        modbus_free(ctx);
+        write_reg(ctx, sck, pzem_id, 0x0003, set_range);
+        cleanup(ctx, sck);
         return 0;
     }
     if (reset_energy)
     {
-        unsigned char raw[4];
-        raw[0] = pzem_id;
-        raw[1] = 0x42;
-        error = modbus_send_raw_request(ctx, raw, 2);
-        printf("modbus_send_raw_request error %d\n", error);
-        error = modbus_receive(ctx, rsp);
-        printf("modbus_receive error %d\n", error);
+        if (sck != -1)
+        {
+            rsp[0] = 0x42;
+            error = tty_socket_request(sck, pzem_id, rsp, 1, rsp,
+                                       sizeof(rsp));
+            printf("tty_socket_request error %d\n", error);
+        }
+        else
+        {
+            unsigned char raw[4];
+            raw[0] = pzem_id;
+            raw[1] = 0x42;
+            error = modbus_send_raw_request(ctx, raw, 2);
+            printf("modbus_send_raw_request error %d\n", error);
+            error = modbus_receive(ctx, rsp);
+            printf("modbus_receive error %d\n", error);
+        }
         usleep(1000 * 1000);
     }
     if (show_slave_params)
     {
-        error = modbus_read_registers(ctx, 0x0000, 4, registers);
+        error = read_regs(ctx, sck, pzem_id, 0, 0x0000, 4, registers);
         if (error == 4)
         {
             printf("high volt alarm %f low volt alarm %f "
@@ -196,7 +296,7 @@ main(int argc, char** argv)
     }
     for (index = 0; index < loop; index++)
     {
-        error = modbus_read_input_registers(ctx, 0x0000, 8, registers);
+        error = read_regs(ctx, sck, pzem_id, 1, 0x0000, 8, registers);
         if (error == 8)
         {
             printf("index %d volts %f current(A) %f power(W) %f enerrgy(Wh) %d "
@@ -218,6 +318,6 @@ main(int argc, char** argv)
             usleep(loop_delay * 1000* 1000);
         }
     }
-    modbus_free(ctx);
+    cleanup(ctx, sck);
     return 0;
 }
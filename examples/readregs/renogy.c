@@ -6,6 +6,8 @@
 #include <unistd.h>
 #include <modbus.h>
 
+#include "tty_socket.h"
+
 // now set to change shun type for id 6 pzem
 
 static int g_debug = 1;
@@ -21,6 +23,32 @@ main(int argc, char** argv)
     modbus_error_recovery_mode er_mode;
     uint16_t tab_rp_registers[4];
     int error;
+    int sck;
+    int index;
+
+    if ((argc > 1) && (strcmp(argv[1], "--via-socket") == 0))
+    {
+        // go through tty_reader, it owns the tty
+        sck = tty_socket_connect((argc > 2) ? argv[2] :
+                                 TTY_SOCKET_DEFAULT_PATH);
+        if (sck == -1)
+        {
+            printf("main: tty_socket_connect failed: %s\n",
+                   strerror(errno));
+            return 1;
+        }
+        for (index = 0; index < 10; index++)
+        {
+            error = tty_socket_read_registers(sck, g_renogy_id, 0x04, index,
+                                              1, tab_rp_registers);
+            printf("tty_socket_read_registers index %d error %d "
+                   "read 0x%4.4X %d\n", index, error,
+                   tab_rp_registers[0], tab_rp_registers[0]);
+            usleep(1000 * 1000 * 1);
+        }
+        close(sck);
+        return 0;
+    }
 
     //ctx = modbus_new_rtu("/dev/ttyS0", 9600, 'N', 8, 1);
     ctx = modbus_new_rtu("/dev/ttyUSB0", 9600, 'N', 8, 1);
@@ -71,7 +99,6 @@ main(int argc, char** argv)
 
     // tab_rp_registers[0] = 0;
 
-    int index;
     for (index = 0; index < 10; index++)
     {
         error = modbus_read_input_registers(ctx, index, 1, tab_rp_registers);
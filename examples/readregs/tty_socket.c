@@ -0,0 +1,334 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "tty_socket.h"
+
+/* message codes, see tty_reader.zig */
+#define TTY_MSG_REQUEST 2
+#define TTY_MSG_RESPONSE 3
+
+/* how long to wait for tty_reader to answer */
+#define TTY_SOCKET_TIMEOUT_MS 10000
+
+static uint32_t g_tag = 0;
+
+/*****************************************************************************/
+static void
+out_u16_le(uint8_t* p, int val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+}
+
+/*****************************************************************************/
+static int
+in_u16_le(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/*****************************************************************************/
+static int
+send_all(int sck, const uint8_t* data, int bytes)
+{
+    int sent;
+
+    while (bytes > 0)
+    {
+        sent = send(sck, data, bytes, 0);
+        if (sent < 1)
+        {
+            return -1;
+        }
+        data += sent;
+        bytes -= sent;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+recv_all(int sck, uint8_t* data, int bytes)
+{
+    struct pollfd pfd;
+    int readed;
+
+    while (bytes > 0)
+    {
+        pfd.fd = sck;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, TTY_SOCKET_TIMEOUT_MS) < 1)
+        {
+            return -1;
+        }
+        readed = recv(sck, data, bytes, 0);
+        if (readed < 1)
+        {
+            return -1;
+        }
+        data += readed;
+        bytes -= readed;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns socket or -1 */
+int
+tty_socket_connect(const char* path)
+{
+    struct sockaddr_un sa;
+    int sck;
+
+    sck = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sck == -1)
+    {
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+    if (connect(sck, (struct sockaddr*)&sa, sizeof(sa)) != 0)
+    {
+        close(sck);
+        return -1;
+    }
+    return sck;
+}
+
+/*****************************************************************************/
+/* send pdu, function code and data, to slave id and wait for the
+   response pdu, register values and status messages for other peers
+   arriving meanwhile are skipped
+   returns response pdu length or -1 */
+int
+tty_socket_request(int sck, int id, const uint8_t* pdu, int pdu_len,
+                   uint8_t* rsp_pdu, int rsp_pdu_max)
+{
+    uint8_t msg[64 * 1024];
+    uint32_t tag;
+    int size;
+    int reason;
+    int rsp_len;
+
+    if ((pdu_len < 1) || (pdu_len > 253))
+    {
+        return -1;
+    }
+    tag = ++g_tag;
+    size = 2 + 2 + 4 + 2 + 2 + pdu_len;
+    out_u16_le(msg + 0, TTY_MSG_REQUEST);
+    out_u16_le(msg + 2, size);
+    out_u16_le(msg + 4, tag);
+    out_u16_le(msg + 6, tag >> 16);
+    out_u16_le(msg + 8, id);
+    out_u16_le(msg + 10, pdu_len);
+    memcpy(msg + 12, pdu, pdu_len);
+    if (send_all(sck, msg, size) != 0)
+    {
+        return -1;
+    }
+    while (1)
+    {
+        if (recv_all(sck, msg, 4) != 0)
+        {
+            return -1;
+        }
+        size = in_u16_le(msg + 2);
+        if ((size < 4) || (recv_all(sck, msg + 4, size - 4) != 0))
+        {
+            return -1;
+        }
+        if ((in_u16_le(msg) != TTY_MSG_RESPONSE) || (size < 14))
+        {
+            continue;
+        }
+        if ((uint32_t)(in_u16_le(msg + 4) | (in_u16_le(msg + 6) << 16)) !=
+            tag)
+        {
+            continue;
+        }
+        reason = in_u16_le(msg + 10);
+        rsp_len = in_u16_le(msg + 12);
+        if ((rsp_len > size - 14) || (rsp_len > rsp_pdu_max))
+        {
+            return -1;
+        }
+        if (reason != 0)
+        {
+            if ((reason == 5) && (rsp_len >= 2))
+            {
+                printf("tty_socket_request: id %d exception %d\n",
+                       id, msg[15]);
+            }
+            else
+            {
+                printf("tty_socket_request: id %d failed reason %d\n",
+                       id, reason);
+            }
+            return -1;
+        }
+        memcpy(rsp_pdu, msg + 14, rsp_len);
+        return rsp_len;
+    }
+}
+
+/*****************************************************************************/
+/* function is 0x03 holding or 0x04 input
+   returns count or -1 */
+int
+tty_socket_read_registers(int sck, int id, int function, int address,
+                          int count, uint16_t* regs)
+{
+    uint8_t pdu[5];
+    uint8_t rsp[253];
+    int rsp_len;
+    int index;
+
+    pdu[0] = function;
+    pdu[1] = address >> 8;
+    pdu[2] = address;
+    pdu[3] = count >> 8;
+    pdu[4] = count;
+    rsp_len = tty_socket_request(sck, id, pdu, 5, rsp, sizeof(rsp));
+    if ((rsp_len < 2) || (rsp[1] != count * 2) || (rsp_len < 2 + count * 2))
+    {
+        return -1;
+    }
+    for (index = 0; index < count; index++)
+    {
+        regs[index] = (rsp[2 + index * 2] << 8) | rsp[3 + index * 2];
+    }
+    return count;
+}
+
+/*****************************************************************************/
+/* returns 1 or -1 */
+int
+tty_socket_write_register(int sck, int id, int address, int value)
+{
+    uint8_t pdu[5];
+    uint8_t rsp[253];
+    int rsp_len;
+
+    pdu[0] = 0x06;
+    pdu[1] = address >> 8;
+    pdu[2] = address;
+    pdu[3] = value >> 8;
+    pdu[4] = value;
+    rsp_len = tty_socket_request(sck, id, pdu, 5, rsp, sizeof(rsp));
+    if (rsp_len != 5)
+    {
+        return -1;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* write then read in one 0x17, tty_reader splits it in two for slaves
+   not set up with write_read
+   returns read_count or -1 */
+int
+tty_socket_write_read_registers(int sck, int id, int write_address,
+                                int write_count, const uint16_t* write_regs,
+                                int read_address, int read_count,
+                                uint16_t* read_regs)
+{
+    uint8_t pdu[253];
+    uint8_t rsp[253];
+    int rsp_len;
+    int index;
+
+    if ((write_count < 1) || (write_count > 121) ||
+        (read_count < 1) || (read_count > 125))
+    {
+        return -1;
+    }
+    pdu[0] = 0x17;
+    pdu[1] = read_address >> 8;
+    pdu[2] = read_address;
+    pdu[3] = read_count >> 8;
+    pdu[4] = read_count;
+    pdu[5] = write_address >> 8;
+    pdu[6] = write_address;
+    pdu[7] = write_count >> 8;
+    pdu[8] = write_count;
+    pdu[9] = write_count * 2;
+    for (index = 0; index < write_count; index++)
+    {
+        pdu[10 + index * 2] = write_regs[index] >> 8;
+        pdu[11 + index * 2] = write_regs[index];
+    }
+    rsp_len = tty_socket_request(sck, id, pdu, 10 + write_count * 2,
+                                 rsp, sizeof(rsp));
+    if ((rsp_len < 2) || (rsp[1] != read_count * 2) ||
+        (rsp_len < 2 + read_count * 2))
+    {
+        return -1;
+    }
+    for (index = 0; index < read_count; index++)
+    {
+        read_regs[index] = (rsp[2 + index * 2] << 8) | rsp[3 + index * 2];
+    }
+    return read_count;
+}
+
+/*****************************************************************************/
+/* one byte per coil in coils, 0 or 1
+   returns count or -1 */
+int
+tty_socket_read_coils(int sck, int id, int address, int count,
+                      uint8_t* coils)
+{
+    uint8_t pdu[5];
+    uint8_t rsp[253];
+    int rsp_len;
+    int index;
+
+    pdu[0] = 0x01;
+    pdu[1] = address >> 8;
+    pdu[2] = address;
+    pdu[3] = count >> 8;
+    pdu[4] = count;
+    rsp_len = tty_socket_request(sck, id, pdu, 5, rsp, sizeof(rsp));
+    if ((rsp_len < 2) || (rsp[1] != (count + 7) / 8) ||
+        (rsp_len < 2 + rsp[1]))
+    {
+        return -1;
+    }
+    for (index = 0; index < count; index++)
+    {
+        coils[index] = (rsp[2 + index / 8] >> (index % 8)) & 1;
+    }
+    return count;
+}
+
+/*****************************************************************************/
+/* returns 1 or -1 */
+int
+tty_socket_write_coil(int sck, int id, int address, int on)
+{
+    uint8_t pdu[5];
+    uint8_t rsp[253];
+    int rsp_len;
+
+    pdu[0] = 0x05;
+    pdu[1] = address >> 8;
+    pdu[2] = address;
+    pdu[3] = on ? 0xFF : 0x00;
+    pdu[4] = 0x00;
+    rsp_len = tty_socket_request(sck, id, pdu, 5, rsp, sizeof(rsp));
+    if (rsp_len != 5)
+    {
+        return -1;
+    }
+    return 1;
+}
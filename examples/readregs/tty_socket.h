@@ -0,0 +1,32 @@
+#ifndef __TTY_SOCKET_H
+#define __TTY_SOCKET_H
+
+#include <stdint.h>
+
+/* modbus requests through a running tty_reader instead of the tty, so
+   the tools do not fight tty_reader for the bus */
+
+#define TTY_SOCKET_DEFAULT_PATH "/tmp/tty_reader.socket"
+
+int
+tty_socket_connect(const char* path);
+int
+tty_socket_request(int sck, int id, const uint8_t* pdu, int pdu_len,
+                   uint8_t* rsp_pdu, int rsp_pdu_max);
+int
+tty_socket_read_registers(int sck, int id, int function, int address,
+                          int count, uint16_t* regs);
+int
+tty_socket_write_register(int sck, int id, int address, int value);
+int
+tty_socket_write_read_registers(int sck, int id, int write_address,
+                                int write_count, const uint16_t* write_regs,
+                                int read_address, int read_count,
+                                uint16_t* read_regs);
+int
+tty_socket_read_coils(int sck, int id, int address, int count,
+                      uint8_t* coils);
+int
+tty_socket_write_coil(int sck, int id, int address, int on);
+
+#endif
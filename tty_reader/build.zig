@@ -19,7 +19,6 @@ pub fn build(b: *std.Build) !void
     tty_reader.linkLibC();
     tty_reader.addIncludePath(b.path("."));
     tty_reader.addCSourceFiles(.{.files = libtomlc_files});
-    tty_reader.linkSystemLibrary("modbus");
     tty_reader.root_module.addImport("hexdump", b.createModule(.{
         .root_source_file = b.path("common/hexdump.zig"),
     }));
@@ -77,6 +76,24 @@ pub fn build(b: *std.Build) !void
     tty_reader_heyu.addCSourceFiles(.{.files = libtomlc_files});
     setExtraLibraryPaths(tty_reader_heyu, target);
     b.installArtifact(tty_reader_heyu);
+    // zig build test, test blocks in tty_reader.zig and what it imports
+    const tty_reader_test = myAddTest(b, "tty_reader.zig", target, optimize);
+    tty_reader_test.linkLibC();
+    tty_reader_test.addIncludePath(b.path("."));
+    tty_reader_test.addCSourceFiles(.{.files = libtomlc_files});
+    tty_reader_test.root_module.addImport("hexdump", b.createModule(.{
+        .root_source_file = b.path("common/hexdump.zig"),
+    }));
+    tty_reader_test.root_module.addImport("log", b.createModule(.{
+        .root_source_file = b.path("common/log.zig"),
+    }));
+    tty_reader_test.root_module.addImport("parse", b.createModule(.{
+        .root_source_file = b.path("common/parse.zig"),
+    }));
+    setExtraLibraryPaths(tty_reader_test, target);
+    const run_tty_reader_test = b.addRunArtifact(tty_reader_test);
+    const test_step = b.step("test", "Run the unit tests");
+    test_step.dependOn(&run_tty_reader_test.step);
 }
 
 //*****************************************************************************
@@ -116,6 +133,28 @@ fn myAddExecutable(b: *std.Build, name: []const u8,
     });
 }
 
+//*****************************************************************************
+fn myAddTest(b: *std.Build, root_source_file: []const u8,
+        target: std.Build.ResolvedTarget,
+        optimize: std.builtin.OptimizeMode) *std.Build.Step.Compile
+{
+    if ((builtin.zig_version.major == 0) and (builtin.zig_version.minor < 15))
+    {
+        return b.addTest(.{
+            .root_source_file = b.path(root_source_file),
+            .target = target,
+            .optimize = optimize,
+        });
+    }
+    return b.addTest(.{
+        .root_module = b.createModule(.{
+            .root_source_file = b.path(root_source_file),
+            .target = target,
+            .optimize = optimize,
+        }),
+    });
+}
+
 //*****************************************************************************
 fn update_git_zig(allocator: std.mem.Allocator) !void
 {
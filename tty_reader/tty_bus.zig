@@ -0,0 +1,1464 @@
+const std = @import("std");
+const log = @import("log");
+const hexdump = @import("hexdump");
+const tty = @import("tty_reader.zig");
+const sched = @import("tty_sched.zig");
+const rtu = @import("tty_rtu.zig");
+const tcp = @import("tty_tcp.zig");
+const plan = @import("tty_plan.zig");
+const sniff = @import("tty_sniff.zig");
+const rt = @import("tty_rt.zig");
+const posix = std.posix;
+
+pub const g_tty_name_max_length = 128;
+// a bus that fails is opened again after this long
+const g_retry_mstime: i64 = 60000;
+
+// commands from the main thread to a bus thread, one byte on the wake pipe
+pub const g_cmd_quit: u8 = 'q';
+pub const g_cmd_stats: u8 = 's';
+pub const g_cmd_peers: u8 = 'p';
+pub const g_cmd_jobs: u8 = 'j';
+
+// why a read failed, in status messages
+pub const g_reason_timeout: u16 = 1;
+pub const g_reason_crc: u16 = 2;
+pub const g_reason_framing: u16 = 3;
+pub const g_reason_bad_response: u16 = 4;
+pub const g_reason_exception: u16 = 5;
+pub const g_reason_other: u16 = 6;
+
+// why a job did not get on the bus
+pub const BusError = error
+{
+    BusStopped,
+    BusDown,
+    NoPeers,
+    LinkClosed,
+    ListenOnly,
+};
+
+pub const tty_bus_type_t = enum
+{
+    Rtu, // serial tty
+    Tcp, // modbus tcp, several requests in flight
+    RtuTcp, // rtu frames through a tcp gateway, one at a time
+};
+
+pub const tty_bus_config_t = struct // [main] defaults, [busN] overrides
+{
+    bus_type: tty_bus_type_t = .Rtu,
+    tty: [g_tty_name_max_length:0]u8 = .{0} ** g_tty_name_max_length,
+    host: [g_tty_name_max_length:0]u8 = .{0} ** g_tty_name_max_length,
+    port: u16 = 502,
+    max_inflight: u8 = 4, // Tcp only
+    baud: u32 = 9600,
+    parity: u8 = 'N',
+    data_bits: u8 = 8,
+    stop_bits: u8 = 1,
+    modbus_debug: bool = false,
+    // Rtu only, never transmit, decode another master's reads
+    sniff: bool = false,
+    item_mstime: i64 = 0,
+    list_mstime: i64 = 0,
+    response_mstime: i64 = 500, // ceiling when adaptive_response
+    // measure each slave and set its timeout and the gap after it
+    adaptive_response: bool = false,
+    response_floor_mstime: i64 = 20,
+    gap_floor_mstime: i64 = 0, // item_mstime is the ceiling
+    // timeouts in a row that open a slave's circuit breaker
+    breaker_timeouts: u32 = 3,
+    breaker_min_mstime: i64 = 5000, // first backoff, doubles each probe
+    breaker_max_mstime: i64 = 300000,
+    // past its deadline by this much a transaction goes ahead of any
+    // priority
+    starve_mstime: i64 = 10000,
+    // a peer request is late this long after it came in, counted in
+    // job_deadline_misses
+    request_deadline_mstime: i64 = 1000,
+    merge_gap: u16 = 16, // max unused registers read to save a transaction
+    // Rtu only, each can be turned on alone to see what it is worth in
+    // the first byte and send late stats
+    low_latency: bool = false, // ASYNC_LOW_LATENCY on the tty
+    latency_timer_mstime: u8 = 0, // usb serial latency timer, 0 is leave
+    rt_priority: u8 = 0, // SCHED_FIFO for the bus thread, 0 is off
+    cpu_affinity: ?u16 = null, // pin the bus thread
+    // keep polling with no peers so the cache is warm when one connects
+    warm_polling: bool = false,
+    align_to_clock: bool = false, // deadlines on wall clock multiples
+    align_offset_mstime: i64 = 0,
+};
+
+pub const tty_bus_info_t = struct // one for each bus, polled by its own thread
+{
+    bus: u8 = 0,
+    config: tty_bus_config_t = .{},
+    allocator: std.mem.Allocator = undefined,
+    info: *tty.tty_info_t = undefined,
+    id_list: std.ArrayListUnmanaged(tty.tty_id_info_t) = .{},
+    read_list: std.ArrayListUnmanaged(tty.tty_read_info_t) = .{},
+    rtu: rtu.rtu_t = .{},
+    tcp: tcp.tcp_t = .{},
+    pending: ?xact_t = null, // on the bus, Rtu only
+    sniff: sniff.sniff_t = .{}, // config.sniff only
+    sched: sched.sched_t = .{},
+    last_modbus_time: ?i64 = null,
+    last_id_index: ?usize = null, // slave of the last transaction
+    jitter: sched.hist_t = .{}, // all reads on this bus
+    // microseconds, Rtu only, request on the wire to first response byte
+    // and how late the request went out after the bus was free
+    first_byte: sched.hist_t = .{},
+    send_late: sched.hist_t = .{},
+    read_deadline_misses: u64 = 0,
+    job_deadline_misses: u64 = 0,
+    jobs_done: u64 = 0,
+    // measured occupancy, transaction time plus guard since busy_start
+    busy_us: i64 = 0,
+    busy_start_mstime: i64 = 0,
+    // scratch for one read or sniffed pair, reset each time, keeps its
+    // memory so a cycle does not allocate, bus thread only
+    scratch: std.heap.ArenaAllocator = undefined,
+    thread: ?std.Thread = null,
+    wake: [2]i32 = .{-1, -1}, // main thread to bus thread
+    // jobs from the main thread, moved into sched by the bus thread
+    job_mutex: std.Thread.Mutex = .{},
+    job_head: ?*tty.tty_job_t = null,
+    job_tail: ?*tty.tty_job_t = null,
+
+    //*************************************************************************
+    pub fn create(allocator: std.mem.Allocator, info: *tty.tty_info_t,
+            bus: u8, config: *const tty_bus_config_t) !*tty_bus_info_t
+    {
+        const self = try allocator.create(tty_bus_info_t);
+        self.* = .{.bus = bus, .config = config.*, .allocator = allocator,
+                .info = info,
+                .scratch = std.heap.ArenaAllocator.init(allocator)};
+        self.sched.init(allocator);
+        return self;
+    }
+
+    //*************************************************************************
+    pub fn delete(self: *tty_bus_info_t) void
+    {
+        self.stop();
+        for (self.id_list.items) |*aitem|
+        {
+            aitem.deinit();
+        }
+        self.id_list.deinit(self.allocator);
+        self.read_list.deinit(self.allocator);
+        self.sched.deinit();
+        self.scratch.deinit();
+        self.allocator.destroy(self);
+    }
+
+    //*************************************************************************
+    // hand a job to the bus thread, from the main thread, the job is
+    // always finished with tty.job_done
+    pub fn submit_job(self: *tty_bus_info_t, job: *tty.tty_job_t) void
+    {
+        if (self.thread == null)
+        {
+            tty.job_done(self.info, job, BusError.BusStopped, &.{});
+            return;
+        }
+        self.job_mutex.lock();
+        job.next = null;
+        if (self.job_tail) |ajob_tail|
+        {
+            ajob_tail.next = job;
+            self.job_tail = job;
+        }
+        else
+        {
+            self.job_head = job;
+            self.job_tail = job;
+        }
+        self.job_mutex.unlock();
+        self.send_cmd(g_cmd_jobs);
+    }
+
+    //*************************************************************************
+    fn take_submitted(self: *tty_bus_info_t) ?*tty.tty_job_t
+    {
+        self.job_mutex.lock();
+        defer self.job_mutex.unlock();
+        const job_head = self.job_head;
+        self.job_head = null;
+        self.job_tail = null;
+        return job_head;
+    }
+
+    //*************************************************************************
+    pub fn start(self: *tty_bus_info_t) !void
+    {
+        if (self.thread != null)
+        {
+            return;
+        }
+        self.wake = try posix.pipe();
+        errdefer
+        {
+            posix.close(self.wake[0]);
+            posix.close(self.wake[1]);
+            self.wake = .{-1, -1};
+        }
+        self.thread = try std.Thread.spawn(.{}, bus_thread, .{self});
+    }
+
+    //*************************************************************************
+    pub fn stop(self: *tty_bus_info_t) void
+    {
+        const thread = self.thread orelse return;
+        self.send_cmd(g_cmd_quit);
+        thread.join();
+        self.thread = null;
+        fail_jobs(self, BusError.BusStopped);
+        posix.close(self.wake[0]);
+        posix.close(self.wake[1]);
+        self.wake = .{-1, -1};
+    }
+
+    //*************************************************************************
+    pub fn send_cmd(self: *tty_bus_info_t, cmd: u8) void
+    {
+        if (self.thread == null)
+        {
+            return;
+        }
+        const msg: [1]u8 = .{cmd};
+        _ = posix.write(self.wake[1], msg[0..1]) catch return;
+    }
+};
+
+// a transaction on the link, a periodic read or a one shot job
+const xact_t = union(enum)
+{
+    read: usize, // read_list index
+    job: *tty.tty_job_t,
+
+    //*************************************************************************
+    // as a tcp slot key, jobs are at least 2 byte aligned so the low bit
+    // tells them from read indexes
+    fn to_key(self: xact_t) usize
+    {
+        return switch (self)
+        {
+            .read => |aread| aread << 1,
+            .job => |ajob| @intFromPtr(ajob) | 1,
+        };
+    }
+
+    //*************************************************************************
+    fn from_key(key: usize) xact_t
+    {
+        if ((key & 1) != 0)
+        {
+            return .{.job = @ptrFromInt(key & ~@as(usize, 1))};
+        }
+        return .{.read = key >> 1};
+    }
+};
+
+//*****************************************************************************
+pub fn print_bus_info(bus: *tty_bus_info_t) !void
+{
+    const config = &bus.config;
+    if (config.bus_type == .Rtu)
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "bus {}: tty_name [{s}] baud [{}] parity [{c}] " ++
+                "data_bits [{}] stop_bits [{}] modbus_debug [{}] " ++
+                "sniff [{}]",
+                .{bus.bus, std.mem.sliceTo(&config.tty, 0), config.baud,
+                config.parity, config.data_bits, config.stop_bits,
+                config.modbus_debug, config.sniff});
+    }
+    else
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "bus {}: type [{s}] host [{s}] port [{}] " ++
+                "max_inflight [{}] modbus_debug [{}]",
+                .{bus.bus, @tagName(config.bus_type),
+                std.mem.sliceTo(&config.host, 0), config.port,
+                config.max_inflight, config.modbus_debug});
+    }
+    try log.logln(log.LogLevel.info, @src(),
+            "  item_mstime [{}] list_mstime [{}] merge_gap [{}] " ++
+            "response_mstime [{}]",
+            .{config.item_mstime, config.list_mstime, config.merge_gap,
+            config.response_mstime});
+    try log.logln(log.LogLevel.info, @src(),
+            "  align_to_clock [{}] align_offset_mstime [{}] " ++
+            "warm_polling [{}]",
+            .{config.align_to_clock, config.align_offset_mstime,
+            config.warm_polling});
+    try log.logln(log.LogLevel.info, @src(),
+            "  adaptive_response [{}] response_floor_mstime [{}] " ++
+            "gap_floor_mstime [{}]",
+            .{config.adaptive_response, config.response_floor_mstime,
+            config.gap_floor_mstime});
+    if (config.bus_type == .Rtu)
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "  low_latency [{}] latency_timer_mstime [{}] " ++
+                "rt_priority [{}] cpu_affinity [{?}]",
+                .{config.low_latency, config.latency_timer_mstime,
+                config.rt_priority, config.cpu_affinity});
+    }
+    try log.logln(log.LogLevel.info, @src(),
+            "  breaker_timeouts [{}] breaker_min_mstime [{}] " ++
+            "breaker_max_mstime [{}] starve_mstime [{}]",
+            .{config.breaker_timeouts, config.breaker_min_mstime,
+            config.breaker_max_mstime, config.starve_mstime});
+    try log.logln(log.LogLevel.info, @src(),
+            "  got [{}] item to monitor", .{bus.id_list.items.len});
+    for (0..bus.id_list.items.len) |index|
+    {
+        const item = &bus.id_list.items[index];
+        try log.logln(log.LogLevel.info, @src(),
+                "    index {} item id {} block count {}",
+                .{index, item.id, item.blocks.items.len});
+        for (item.blocks.items) |*block|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "      type {} address {} count {} deadband {}",
+                    .{block.reg_type, block.address, block.count,
+                    block.deadband != null});
+        }
+    }
+    try log.logln(log.LogLevel.info, @src(),
+            "  got [{}] planned reads", .{bus.read_list.items.len});
+    for (bus.read_list.items) |*read|
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "    id {} type {} address {} count {} blocks {} " ++
+                "interval_mstime {} priority {} align_to_clock {} " ++
+                "static {}",
+                .{read.id, read.reg_type, read.address, read.count,
+                read.block_count, read.interval_mstime, read.priority,
+                read.align_to_clock, read.static});
+    }
+    const busy = plan.occupancy(config, bus.read_list.items);
+    try log.logln(log.LogLevel.info, @src(),
+            "  planned occupancy {d:.1}% cycle_mstime {}",
+            .{busy * 100.0,
+            (plan.cycle_us(config, bus.read_list.items) + 999) / 1000});
+    if (busy > 1.0)
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "  bus {} is overloaded, intervals will stretch, " ++
+                "see tty_reader --plan", .{bus.bus});
+    }
+}
+
+//*****************************************************************************
+fn print_hist(name: []const u8, unit: []const u8,
+        hist: *const sched.hist_t) !void
+{
+    try log.logln(log.LogLevel.info, @src(),
+            "  {s}: count {} mean {} {s} max {} {s}",
+            .{name, hist.total, hist.mean(), unit, hist.max, unit});
+    for (hist.counts, 0..) |count, index|
+    {
+        if (count > 0)
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "    <= {} {s}: {}",
+                    .{sched.hist_t.bucket_max(index), unit, count});
+        }
+    }
+}
+
+//*****************************************************************************
+// on SIGUSR1, log scheduled vs actual start time of the transactions
+fn print_stats(bus: *tty_bus_info_t) !void
+{
+    try log.logln(log.LogLevel.info, @src(), "bus {} stats:", .{bus.bus});
+    try log.logln(log.LogLevel.info, @src(),
+            "  queue depth {} max {} deadline misses reads {} jobs {} " ++
+            "jobs done {}",
+            .{bus.sched.depth(), bus.sched.max_depth,
+            bus.read_deadline_misses, bus.job_deadline_misses,
+            bus.jobs_done});
+    const elapsed_us = (std.time.milliTimestamp() - bus.busy_start_mstime) *
+            1000;
+    const measured: f64 = if (elapsed_us < 1) 0.0 else
+            @as(f64, @floatFromInt(bus.busy_us)) /
+            @as(f64, @floatFromInt(elapsed_us)) / plan.lanes(&bus.config);
+    try log.logln(log.LogLevel.info, @src(),
+            "  occupancy measured {d:.1}% planned {d:.1}%",
+            .{measured * 100.0,
+            plan.occupancy(&bus.config, bus.read_list.items) * 100.0});
+    if (bus.config.sniff)
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "  sniffed frames {} pairs {} skipped bytes {} " ++
+                "dropped partial frames {}",
+                .{bus.sniff.frames, bus.sniff.pairs,
+                bus.sniff.skipped_bytes, bus.sniff.dropped_partial});
+        return;
+    }
+    try print_hist("jitter all reads", "ms", &bus.jitter);
+    if (bus.config.bus_type == .Rtu)
+    {
+        try print_hist("first byte", "us", &bus.first_byte);
+        try print_hist("send late", "us", &bus.send_late);
+    }
+    for (bus.read_list.items) |*read|
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "  id {} type {} address {} count {} missed {} " ++
+                "deadline misses {} interval_mstime {}",
+                .{read.id, read.reg_type, read.address, read.count,
+                read.missed, read.deadline_misses, read.interval_mstime});
+        try print_hist("jitter", "ms", &read.jitter);
+    }
+    const config = &bus.config;
+    for (bus.id_list.items) |*item|
+    {
+        const latency = &item.latency;
+        try log.logln(log.LogLevel.info, @src(),
+                "  id {} samples {} srtt {} us rttvar {} us p95 {} us " ++
+                "timeout {} us timeouts {}",
+                .{item.id, latency.sample_count, latency.srtt_us,
+                latency.rttvar_us, latency.p95(),
+                latency.timeout_us(config.response_floor_mstime * 1000,
+                config.response_mstime * 1000), latency.timeouts});
+        const health = &item.health;
+        try log.logln(log.LogLevel.info, @src(),
+                "  id {} health {s} failures {} skipped {} backoff {} ms",
+                .{item.id, @tagName(health.state), health.failures,
+                health.skipped, health.backoff_mstime});
+    }
+}
+
+//*****************************************************************************
+fn hexdump_slice(slice: []u16) !void
+{
+    var u8_slice: []u8 = undefined;
+    u8_slice.ptr = @ptrCast(slice.ptr);
+    u8_slice.len = slice.len * 2;
+    try hexdump.printHexDump(0, u8_slice);
+}
+
+//*****************************************************************************
+// smaller of two poll timeouts where -1 is forever
+pub fn min_timeout(a: i32, b: i32) i32
+{
+    if (a < 0)
+    {
+        return b;
+    }
+    if (b < 0)
+    {
+        return a;
+    }
+    return @min(a, b);
+}
+
+//*****************************************************************************
+fn response_timeout_us(bus: *tty_bus_info_t, id_index: ?usize) i64
+{
+    const config = &bus.config;
+    const ceiling_us = config.response_mstime * 1000;
+    if (!config.adaptive_response)
+    {
+        return ceiling_us;
+    }
+    const aid_index = id_index orelse return ceiling_us;
+    const latency = &bus.id_list.items[aid_index].latency;
+    return latency.timeout_us(config.response_floor_mstime * 1000,
+            ceiling_us);
+}
+
+//*****************************************************************************
+// time between transactions, item_mstime or, when adaptive_response,
+// about one response time of the slave on the bus last
+fn guard_mstime(bus: *tty_bus_info_t) i64
+{
+    const config = &bus.config;
+    if (!config.adaptive_response)
+    {
+        return config.item_mstime;
+    }
+    const id_index = bus.last_id_index orelse return config.gap_floor_mstime;
+    const latency = &bus.id_list.items[id_index].latency;
+    return latency.gap_mstime(config.gap_floor_mstime, config.item_mstime);
+}
+
+//*****************************************************************************
+// id_list index of a slave, null for jobs to slaves not configured
+fn get_id_index(bus: *tty_bus_info_t, id: u8) ?usize
+{
+    for (bus.id_list.items, 0..) |*item, index|
+    {
+        if (item.id == id)
+        {
+            return index;
+        }
+    }
+    return null;
+}
+
+//*****************************************************************************
+fn start_pdu(bus: *tty_bus_info_t, xact: xact_t, id: u8, pdu: []const u8,
+        id_index: ?usize) !void
+{
+    const now_us = std.time.microTimestamp();
+    const response_us = response_timeout_us(bus, id_index);
+    switch (bus.config.bus_type)
+    {
+        .Rtu =>
+        {
+            bus.rtu.response_us = response_us;
+            try bus.rtu.start(id, pdu, now_us);
+            bus.pending = xact;
+        },
+        .Tcp, .RtuTcp =>
+        {
+            bus.tcp.response_us = response_us;
+            try bus.tcp.start(id, pdu, xact.to_key(), now_us);
+        },
+    }
+    bus.last_id_index = id_index;
+}
+
+//*****************************************************************************
+// put the request for a planned read on the bus, the response is
+// handled by complete_read when the link has it
+fn start_read(bus: *tty_bus_info_t, read_index: usize) !void
+{
+    const read = &bus.read_list.items[read_index];
+    const function: u8 = if (read.reg_type == tty.g_reg_type_holding) 0x03
+            else 0x04;
+    var pdu_buf: [8]u8 = undefined;
+    const pdu = rtu.read_pdu(&pdu_buf, function, read.address, read.count);
+    try log.logln_devel(log.LogLevel.info, @src(),
+            "bus {} id {} function {} address {} count {}",
+            .{bus.bus, read.id, function, read.address, read.count});
+    try start_pdu(bus, .{.read = read_index}, read.id, pdu, read.id_index);
+    read.in_flight = true;
+}
+
+//*****************************************************************************
+// 0x17 pdu is function, read address and count, write address, count
+// and byte count then the values, 10 bytes before the values
+fn split_pdu(job: *tty.tty_job_t, buf: []u8) []const u8
+{
+    const pdu = job.pdu[0..job.pdu_len];
+    switch (job.step)
+    {
+        .Whole => return pdu,
+        .Write =>
+        {
+            // 0x10 is write address, count, byte count and the values
+            buf[0] = 0x10;
+            std.mem.copyForwards(u8, buf[1..], pdu[5..]);
+            return buf[0..pdu.len - 4];
+        },
+        .Read =>
+        {
+            return rtu.read_pdu(buf, 0x03,
+                    std.mem.readInt(u16, pdu[1..3], .big),
+                    std.mem.readInt(u16, pdu[3..5], .big));
+        },
+    }
+}
+
+//*****************************************************************************
+fn start_job(bus: *tty_bus_info_t, job: *tty.tty_job_t) !void
+{
+    const id_index = get_id_index(bus, job.id);
+    if ((job.step == .Whole) and (job.pdu[0] == 0x17) and
+            (job.pdu_len >= 10))
+    {
+        const write_read = if (id_index) |aid_index|
+                bus.id_list.items[aid_index].write_read else false;
+        if (!write_read)
+        {
+            job.step = .Write;
+        }
+    }
+    var pdu_buf: [253]u8 = undefined;
+    const pdu = split_pdu(job, &pdu_buf);
+    try log.logln_devel(log.LogLevel.info, @src(),
+            "bus {} job id {} function {} {s}",
+            .{bus.bus, job.id, pdu[0], @tagName(job.step)});
+    // a bad request from a peer fails that job only, a dead link shows
+    // up on the next poll
+    start_pdu(bus, .{.job = job}, job.id, pdu, id_index) catch |err|
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "bus {} job id {} function {} start failed {}",
+                .{bus.bus, job.id, pdu[0], err});
+        tty.job_done(bus.info, job, err, &.{});
+    };
+}
+
+//*****************************************************************************
+pub fn status_reason(err: anyerror) u16
+{
+    if ((err == rtu.RtuError.RtuTimeout) or (err == tcp.TcpError.TcpTimeout))
+    {
+        return g_reason_timeout;
+    }
+    if ((err == rtu.RtuError.RtuCrcError) or
+            (err == tcp.TcpError.TcpCrcError))
+    {
+        return g_reason_crc;
+    }
+    if (err == rtu.RtuError.RtuFramingError)
+    {
+        return g_reason_framing;
+    }
+    if ((err == rtu.RtuError.RtuBadResponse) or
+            (err == tcp.TcpError.TcpBadResponse))
+    {
+        return g_reason_bad_response;
+    }
+    if ((err == rtu.RtuError.RtuException) or
+            (err == tcp.TcpError.TcpException))
+    {
+        return g_reason_exception;
+    }
+    return g_reason_other;
+}
+
+//*****************************************************************************
+// a failed read is published as a status message, timeouts count toward
+// the slave's circuit breaker, any answer at all closes it
+fn read_failed(bus: *tty_bus_info_t, read: *tty.tty_read_info_t,
+        err: anyerror) !void
+{
+    const config = &bus.config;
+    const health = &bus.id_list.items[read.id_index].health;
+    health.failures += 1;
+    const reason = status_reason(err);
+    const changed = if (reason == g_reason_timeout)
+            health.on_timeout(std.time.milliTimestamp(),
+            config.breaker_timeouts, config.breaker_min_mstime,
+            config.breaker_max_mstime) else health.on_answer();
+    try log.logln(log.LogLevel.info, @src(),
+            "bus {} read id {} type {} address {} count {} failed {} " ++
+            "health {s}",
+            .{bus.bus, read.id, read.reg_type, read.address, read.count,
+            err, @tagName(health.state)});
+    if (changed and (health.state == .Open))
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "bus {} id {} breaker open for {} ms",
+                .{bus.bus, read.id, health.backoff_mstime});
+    }
+    // the first read back is published whatever the deadband
+    const blocks = bus.id_list.items[read.id_index].blocks.items
+            [read.block_index..][0..read.block_count];
+    for (blocks) |*block|
+    {
+        if (block.deadband) |*adeadband|
+        {
+            adeadband.have_last = false;
+        }
+    }
+    try tty.publish_status(bus.info, bus.bus, read.id, read.reg_type,
+            read.address, read.count, @intFromEnum(health.state), reason);
+}
+
+//*****************************************************************************
+// a configured block, unless its deadband holds it back
+fn publish_block(bus: *tty_bus_info_t, id: u8,
+        block: *tty.tty_block_info_t, regs: []u16) !void
+{
+    if (block.deadband) |*adeadband|
+    {
+        if (!adeadband.moved(regs))
+        {
+            return;
+        }
+    }
+    try tty.publish_block(bus.info, id, block.reg_type, block.address, regs);
+}
+
+//*****************************************************************************
+fn complete_read(bus: *tty_bus_info_t, read: *tty.tty_read_info_t,
+        err: ?anyerror, pdu: []const u8) !void
+{
+    _ = bus.scratch.reset(.retain_capacity);
+    const regs = try bus.scratch.allocator().alloc(u16, read.count);
+    var read_err = err;
+    if (read_err == null)
+    {
+        rtu.regs_from_pdu(pdu, regs) catch |aerr|
+        {
+            read_err = aerr;
+        };
+    }
+    if (read_err) |aerr|
+    {
+        return read_failed(bus, read, aerr);
+    }
+    const id_info = &bus.id_list.items[read.id_index];
+    const was_lost = (id_info.health.state == .Open) or
+            (id_info.health.state == .Probing);
+    if (id_info.health.on_answer())
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "bus {} id {} is back", .{bus.bus, read.id});
+        if (was_lost)
+        {
+            // may be a different device now
+            try reread_static(bus, read.id_index);
+        }
+        try tty.publish_status(bus.info, bus.bus, read.id, read.reg_type,
+                read.address, read.count, @intFromEnum(id_info.health.state),
+                0);
+    }
+    if (bus.config.modbus_debug)
+    {
+        try hexdump_slice(regs);
+    }
+    // publish each configured block out of the merged read
+    const blocks = id_info.blocks.items[read.block_index..]
+            [0..read.block_count];
+    for (blocks) |*block|
+    {
+        const offset = block.address - read.address;
+        try publish_block(bus, read.id, block, regs[offset..][0..block.count]);
+    }
+    read.static_valid = read.static;
+    if (read.adapt != null)
+    {
+        const old_interval_mstime = read.interval_mstime;
+        sched.adapt(read, regs, std.time.milliTimestamp());
+        if (read.interval_mstime != old_interval_mstime)
+        {
+            try log.logln_devel(log.LogLevel.info, @src(),
+                    "id {} address {} interval_mstime {} -> {}",
+                    .{read.id, read.address, old_interval_mstime,
+                    read.interval_mstime});
+        }
+    }
+}
+
+//*****************************************************************************
+fn finish_read(bus: *tty_bus_info_t, read_index: usize, err: ?anyerror,
+        pdu: []const u8, latency_us: ?i64) !void
+{
+    const reads = bus.read_list.items;
+    const read = &reads[read_index];
+    read.in_flight = false;
+    const latency = &bus.id_list.items[read.id_index].latency;
+    if (latency_us) |alatency_us|
+    {
+        latency.add(alatency_us);
+    }
+    const now = std.time.milliTimestamp();
+    bus.last_modbus_time = now;
+    if (err) |aerr|
+    {
+        const reason = status_reason(aerr);
+        if (reason == g_reason_timeout)
+        {
+            latency.timeouts += 1;
+        }
+        else if (((reason == g_reason_crc) or (reason == g_reason_framing))
+                and !read.retried and bus.sched.started)
+        {
+            // garbled, retry once as soon as the bus allows, next_mstime
+            // is in the past so it is due right away
+            try log.logln_devel(log.LogLevel.info, @src(),
+                    "bus {} id {} {} retry", .{bus.bus, read.id, aerr});
+            read.retried = true;
+            try bus.sched.reschedule(reads, read_index);
+            return;
+        }
+    }
+    read.retried = false;
+    // complete_read first, an adaptive read that shrank its interval is
+    // due one new interval after this start, not one old interval
+    const complete_rv = complete_read(bus, read, err, pdu);
+    // static reads are tried each interval until one works
+    if (bus.sched.started and (!read.static or !read.static_valid))
+    {
+        sched.advance(read, now);
+        try bus.sched.reschedule(reads, read_index);
+    }
+    try complete_rv;
+}
+
+//*****************************************************************************
+// the slave was gone, read its static blocks again
+fn reread_static(bus: *tty_bus_info_t, id_index: usize) !void
+{
+    const reads = bus.read_list.items;
+    const now = std.time.milliTimestamp();
+    for (reads, 0..) |*read, read_index|
+    {
+        if ((read.id_index == id_index) and read.static_valid)
+        {
+            read.static_valid = false;
+            if (bus.sched.started)
+            {
+                read.next_mstime = now;
+                try bus.sched.reschedule(reads, read_index);
+            }
+        }
+    }
+}
+
+//*****************************************************************************
+fn finish_job(bus: *tty_bus_info_t, job: *tty.tty_job_t, err: ?anyerror,
+        pdu: []const u8) void
+{
+    bus.last_modbus_time = std.time.milliTimestamp();
+    if ((job.step == .Whole) and (job.pdu[0] == 0x17) and
+            (job.pdu_len >= 10) and (pdu.len >= 2) and (pdu[0] == 0x97) and
+            (pdu[1] == 0x01))
+    {
+        // illegal function, the slave does not take 0x17 after all
+        if (get_id_index(bus, job.id)) |aid_index|
+        {
+            bus.id_list.items[aid_index].write_read = false;
+        }
+        log.logln(log.LogLevel.info, @src(),
+                "bus {} id {} no 0x17, split from now on",
+                .{bus.bus, job.id}) catch {};
+        job.step = .Write;
+        return requeue_job(bus, job);
+    }
+    if ((job.step == .Write) and (err == null))
+    {
+        job.step = .Read;
+        return requeue_job(bus, job);
+    }
+    bus.jobs_done += 1;
+    if (job.step != .Whole)
+    {
+        var rsp_buf: [253]u8 = undefined;
+        return tty.job_done(bus.info, job, err, split_rsp(pdu, &rsp_buf));
+    }
+    tty.job_done(bus.info, job, err, pdu);
+}
+
+//*****************************************************************************
+// the peer asked for a 0x17, answer a leg of the split like one,
+// exceptions from either leg too
+fn split_rsp(pdu: []const u8, buf: []u8) []const u8
+{
+    if (pdu.len < 1)
+    {
+        return pdu;
+    }
+    std.mem.copyForwards(u8, buf, pdu);
+    buf[0] = if ((pdu[0] & 0x80) != 0) 0x97 else 0x17;
+    return buf[0..pdu.len];
+}
+
+//*****************************************************************************
+// next step of a split job, it keeps its priority and deadline
+fn requeue_job(bus: *tty_bus_info_t, job: *tty.tty_job_t) void
+{
+    bus.sched.add_job(job) catch |err|
+    {
+        tty.job_done(bus.info, job, err, &.{});
+    };
+}
+
+//*****************************************************************************
+fn finish_xact(bus: *tty_bus_info_t, xact: xact_t, err: ?anyerror,
+        pdu: []const u8, latency_us: ?i64, sent_us: i64) !void
+{
+    const now_us = std.time.microTimestamp();
+    bus.busy_us += now_us - sent_us + guard_mstime(bus) * 1000;
+    switch (xact)
+    {
+        .read => |aread| try finish_read(bus, aread, err, pdu, latency_us),
+        .job => |ajob| finish_job(bus, ajob, err, pdu),
+    }
+}
+
+//*****************************************************************************
+// fail every job the bus holds, submitted or scheduled
+fn fail_jobs(bus: *tty_bus_info_t, err: anyerror) void
+{
+    var job = bus.take_submitted();
+    while (job) |ajob|
+    {
+        job = ajob.next;
+        tty.job_done(bus.info, ajob, err, &.{});
+    }
+    while (bus.sched.take_job()) |ajob|
+    {
+        tty.job_done(bus.info, ajob, err, &.{});
+    }
+}
+
+//*****************************************************************************
+// the link is closing, fail the jobs on it, reads are just started again
+fn fail_link_jobs(bus: *tty_bus_info_t) void
+{
+    if (bus.pending) |apending|
+    {
+        bus.pending = null;
+        switch (apending)
+        {
+            .job => |ajob| tty.job_done(bus.info, ajob, BusError.LinkClosed,
+                    &.{}),
+            .read => |aread| bus.read_list.items[aread].in_flight = false,
+        }
+    }
+    for (&bus.tcp.slots) |*slot|
+    {
+        if (slot.used)
+        {
+            switch (xact_t.from_key(slot.key))
+            {
+                .job => |ajob| tty.job_done(bus.info, ajob,
+                        BusError.LinkClosed, &.{}),
+                .read => |aread|
+                        bus.read_list.items[aread].in_flight = false,
+            }
+            bus.tcp.release(slot);
+        }
+    }
+}
+
+//*****************************************************************************
+// serial fd events and rtu timers, finish the pending read when the rtu
+// is Done
+fn check_rtu(bus: *tty_bus_info_t, revents: i16) !void
+{
+    const now_us = std.time.microTimestamp();
+    if ((revents & posix.POLL.IN) != 0)
+    {
+        try bus.rtu.on_readable(now_us);
+    }
+    if ((revents & posix.POLL.OUT) != 0)
+    {
+        try bus.rtu.on_writable(now_us);
+    }
+    try bus.rtu.check(now_us);
+    if (bus.rtu.state != .Done)
+    {
+        return;
+    }
+    defer bus.rtu.reset();
+    bus.send_late.add(bus.rtu.send_late_us);
+    const xact = bus.pending orelse return;
+    bus.pending = null;
+    var pdu: []const u8 = &.{};
+    var latency_us: ?i64 = null;
+    if (bus.rtu.err == null)
+    {
+        pdu = bus.rtu.pdu();
+        if (bus.rtu.first_byte_us) |afirst_byte_us|
+        {
+            latency_us = afirst_byte_us - bus.rtu.sent_us;
+            bus.first_byte.add(latency_us.?);
+        }
+    }
+    else if (bus.rtu.err) |aerr|
+    {
+        if (aerr == rtu.RtuError.RtuException)
+        {
+            // function and exception code, for job responses
+            pdu = bus.rtu.pdu();
+        }
+    }
+    try finish_xact(bus, xact, bus.rtu.err, pdu, latency_us,
+            bus.rtu.sent_us);
+}
+
+//*****************************************************************************
+// socket events and response timers, finish every read that has its
+// response or timed out
+fn check_tcp(bus: *tty_bus_info_t, revents: i16) !void
+{
+    if ((revents & posix.POLL.OUT) != 0)
+    {
+        try bus.tcp.on_writable();
+    }
+    if ((revents & posix.POLL.IN) != 0)
+    {
+        try bus.tcp.on_readable();
+    }
+    const now_us = std.time.microTimestamp();
+    try bus.tcp.check(now_us);
+    while (bus.tcp.next_done()) |slot|
+    {
+        defer bus.tcp.release(slot);
+        const latency_us: ?i64 = if (slot.err == null)
+                now_us - slot.sent_us else null;
+        try finish_xact(bus, xact_t.from_key(slot.key), slot.err,
+                slot.pdu(), latency_us, slot.sent_us);
+    }
+}
+
+//*****************************************************************************
+fn check_link(bus: *tty_bus_info_t, revents: i16) !void
+{
+    switch (bus.config.bus_type)
+    {
+        .Rtu => try check_rtu(bus, revents),
+        .Tcp, .RtuTcp => try check_tcp(bus, revents),
+    }
+}
+
+//*****************************************************************************
+// true if the link can take another request now
+fn link_can_start(bus: *tty_bus_info_t) bool
+{
+    return switch (bus.config.bus_type)
+    {
+        .Rtu => bus.pending == null,
+        .Tcp, .RtuTcp => bus.tcp.can_start(),
+    };
+}
+
+//*****************************************************************************
+fn check_modbus(bus: *tty_bus_info_t, timeout: *i32) !void
+{
+    const reads = bus.read_list.items;
+    const now = std.time.milliTimestamp();
+    if (!bus.sched.started)
+    {
+        try bus.sched.start(reads, now, bus.config.align_offset_mstime);
+    }
+    try bus.sched.release(reads, now);
+    // keep guard_mstime between the end or start of one transaction and
+    // the start of the next, a Tcp bus with item_mstime 0 fills every
+    // in flight slot at once
+    while (link_can_start(bus))
+    {
+        const guard = guard_mstime(bus);
+        const lmt = bus.last_modbus_time orelse (now - guard);
+        if (now - lmt < guard)
+        {
+            break;
+        }
+        const entry = bus.sched.next_ready(now) orelse break;
+        if (entry.job) |ajob|
+        {
+            if (now > entry.deadline)
+            {
+                bus.job_deadline_misses += 1;
+            }
+            try start_job(bus, ajob);
+            bus.last_modbus_time = now;
+            continue;
+        }
+        const read_index = entry.read_index orelse continue;
+        const read = &reads[read_index];
+        const health = &bus.id_list.items[read.id_index].health;
+        if (!health.allow(now))
+        {
+            // breaker open, skip this slot without using the bus
+            sched.advance(read, now);
+            try bus.sched.reschedule(reads, read_index);
+            continue;
+        }
+        const jitter = now - read.next_mstime;
+        read.jitter.add(jitter);
+        bus.jitter.add(jitter);
+        if (now > entry.deadline)
+        {
+            read.deadline_misses += 1;
+            bus.read_deadline_misses += 1;
+        }
+        try start_read(bus, read_index);
+        bus.last_modbus_time = now;
+    }
+    if (!link_can_start(bus))
+    {
+        // link busy, the link timers set the timeout
+        timeout.* = -1;
+        return;
+    }
+    // calculate timeout from the earliest deadline
+    var nmt = bus.sched.next_mstime(reads, now) orelse
+    {
+        timeout.* = -1;
+        return;
+    };
+    if (bus.last_modbus_time) |almt|
+    {
+        nmt = @max(nmt, almt + guard_mstime(bus));
+    }
+    const max_timeout: i64 = std.math.maxInt(i32);
+    timeout.* = @intCast(std.math.clamp(nmt - now, 0, max_timeout));
+}
+
+//*****************************************************************************
+// read commands from the main thread, returns true on quit
+fn check_wake(bus: *tty_bus_info_t) !bool
+{
+    var cmd_buf: [16]u8 = undefined;
+    const read = posix.read(bus.wake[0], &cmd_buf) catch 0;
+    for (cmd_buf[0..read]) |cmd|
+    {
+        if (cmd == g_cmd_quit)
+        {
+            return true;
+        }
+        if (cmd == g_cmd_stats)
+        {
+            try print_stats(bus);
+        }
+        if (cmd == g_cmd_jobs)
+        {
+            var job = bus.take_submitted();
+            while (job) |ajob|
+            {
+                job = ajob.next;
+                bus.sched.add_job(ajob) catch |err|
+                {
+                    tty.job_done(bus.info, ajob, err, &.{});
+                };
+            }
+        }
+        // g_cmd_peers only wakes up the poll
+    }
+    return false;
+}
+
+//*****************************************************************************
+fn bus_loop(bus: *tty_bus_info_t) !void
+{
+    var polls: [2]posix.pollfd = undefined;
+    while (true)
+    {
+        var timeout: i32 = -1;
+        if ((bus.info.peer_count.load(.acquire) < 1) and
+                !bus.config.warm_polling)
+        {
+            // nobody to answer
+            bus.sched.clear();
+            fail_jobs(bus, BusError.NoPeers);
+            bus.last_modbus_time = null;
+        }
+        else
+        {
+            try check_modbus(bus, &timeout);
+        }
+        const now_us = std.time.microTimestamp();
+        switch (bus.config.bus_type)
+        {
+            .Rtu =>
+            {
+                timeout = min_timeout(timeout, bus.rtu.timeout_ms(now_us));
+                polls[1].fd = bus.rtu.fd;
+                polls[1].events = bus.rtu.poll_events();
+            },
+            .Tcp, .RtuTcp =>
+            {
+                timeout = min_timeout(timeout, bus.tcp.timeout_ms(now_us));
+                polls[1].fd = bus.tcp.fd;
+                polls[1].events = bus.tcp.poll_events();
+            },
+        }
+        try log.logln_devel(log.LogLevel.info, @src(),
+                "bus {} timeout {}", .{bus.bus, timeout});
+        polls[0].fd = bus.wake[0];
+        polls[0].events = posix.POLL.IN;
+        polls[0].revents = 0;
+        polls[1].revents = 0;
+        const poll_rv = try posix.poll(&polls, timeout);
+        // link timers run even when nothing is ready
+        try check_link(bus, if (poll_rv > 0) polls[1].revents else 0);
+        if ((poll_rv > 0) and ((polls[0].revents & posix.POLL.IN) != 0))
+        {
+            if (try check_wake(bus))
+            {
+                return;
+            }
+        }
+    }
+}
+
+//*****************************************************************************
+// low latency tty settings, a failure is logged and the bus runs without
+fn tune_tty(bus: *tty_bus_info_t) !void
+{
+    const config = &bus.config;
+    if (config.low_latency)
+    {
+        bus.rtu.set_low_latency() catch |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} low_latency failed {}", .{bus.bus, err});
+        };
+    }
+    if (config.latency_timer_mstime > 0)
+    {
+        rtu.set_latency_timer(std.mem.sliceTo(&config.tty, 0),
+                config.latency_timer_mstime) catch |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} latency_timer_mstime failed {}",
+                    .{bus.bus, err});
+        };
+    }
+}
+
+//*****************************************************************************
+// real time scheduling for the bus thread, a failure is logged and the
+// thread runs without
+fn tune_thread(bus: *tty_bus_info_t) !void
+{
+    const config = &bus.config;
+    if (config.rt_priority > 0)
+    {
+        rt.set_fifo(config.rt_priority) catch |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} rt_priority failed {}", .{bus.bus, err});
+        };
+    }
+    if (config.cpu_affinity) |acpu|
+    {
+        rt.set_affinity(acpu) catch |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} cpu_affinity failed {}", .{bus.bus, err});
+        };
+    }
+}
+
+//*****************************************************************************
+fn process_rtu(bus: *tty_bus_info_t) !void
+{
+    const config = &bus.config;
+    try bus.rtu.open(std.mem.sliceTo(&config.tty, 0), config.baud,
+            config.parity, config.data_bits, config.stop_bits);
+    defer bus.rtu.close();
+    defer fail_link_jobs(bus);
+    try tune_tty(bus);
+    bus.rtu.debug = config.modbus_debug;
+    bus.rtu.response_us = config.response_mstime * 1000;
+    try log.logln(log.LogLevel.info, @src(),
+            "bus {} rtu open ok fd {} baud {} response_mstime {}",
+            .{bus.bus, bus.rtu.fd, config.baud, config.response_mstime});
+    try bus_loop(bus);
+}
+
+//*****************************************************************************
+fn process_tcp(bus: *tty_bus_info_t) !void
+{
+    const config = &bus.config;
+    try bus.tcp.open(bus.allocator, std.mem.sliceTo(&config.host, 0),
+            config.port, config.bus_type == .RtuTcp, config.max_inflight);
+    defer bus.tcp.close();
+    defer fail_link_jobs(bus);
+    bus.tcp.debug = config.modbus_debug;
+    bus.tcp.response_us = config.response_mstime * 1000;
+    try log.logln(log.LogLevel.info, @src(),
+            "bus {} {s} connect ok fd {} max_inflight {} " ++
+            "response_mstime {}",
+            .{bus.bus, @tagName(config.bus_type), bus.tcp.fd,
+            bus.tcp.max_inflight, config.response_mstime});
+    try bus_loop(bus);
+}
+
+//*****************************************************************************
+fn process_bus(bus: *tty_bus_info_t) !void
+{
+    bus.sched.clear();
+    bus.sched.starve_mstime = bus.config.starve_mstime;
+    bus.busy_us = 0;
+    bus.busy_start_mstime = std.time.milliTimestamp();
+    bus.last_modbus_time = null;
+    bus.last_id_index = null;
+    bus.pending = null;
+    for (bus.read_list.items) |*read|
+    {
+        read.in_flight = false;
+    }
+    for (bus.id_list.items) |*item|
+    {
+        item.health.reset_probe();
+    }
+    for (bus.read_list.items) |*read|
+    {
+        read.retried = false;
+        // the link was down, static blocks are read again
+        read.static_valid = false;
+    }
+    if (bus.config.sniff)
+    {
+        return process_sniff(bus);
+    }
+    switch (bus.config.bus_type)
+    {
+        .Rtu => try process_rtu(bus),
+        .Tcp, .RtuTcp => try process_tcp(bus),
+    }
+}
+
+//*****************************************************************************
+// publish a read another master did, the configured blocks inside it or
+// all of it for slaves without any
+fn sniffed(bus: *tty_bus_info_t, pair: *const sniff.pair_t) !void
+{
+    _ = bus.scratch.reset(.retain_capacity);
+    const regs = try bus.scratch.allocator().alloc(u16, pair.count);
+    rtu.regs_from_pdu(pair.pdu, regs) catch return;
+    const reg_type = if (pair.function == 0x04) tty.g_reg_type_input else
+            tty.g_reg_type_holding;
+    if (bus.config.modbus_debug)
+    {
+        try hexdump_slice(regs);
+    }
+    const id_index = get_id_index(bus, pair.id) orelse
+    {
+        return tty.publish_block(bus.info, pair.id, reg_type, pair.address,
+                regs);
+    };
+    const id_info = &bus.id_list.items[id_index];
+    if (id_info.blocks.items.len < 1)
+    {
+        return tty.publish_block(bus.info, pair.id, reg_type, pair.address,
+                regs);
+    }
+    const read_end: u32 = @as(u32, pair.address) + pair.count;
+    for (id_info.blocks.items) |*block|
+    {
+        const block_end: u32 = @as(u32, block.address) + block.count;
+        if ((block.reg_type != reg_type) or
+                (block.address < pair.address) or (block_end > read_end))
+        {
+            continue;
+        }
+        const offset = block.address - pair.address;
+        try publish_block(bus, pair.id, block, regs[offset..][0..block.count]);
+    }
+}
+
+//*****************************************************************************
+// listen only, nothing is ever written to the tty
+fn process_sniff(bus: *tty_bus_info_t) !void
+{
+    const config = &bus.config;
+    try bus.rtu.open(std.mem.sliceTo(&config.tty, 0), config.baud,
+            config.parity, config.data_bits, config.stop_bits);
+    defer bus.rtu.close();
+    try tune_tty(bus);
+    bus.sniff.init(bus.rtu.frame_gap_us, config.modbus_debug);
+    try log.logln(log.LogLevel.info, @src(),
+            "bus {} sniffing fd {} baud {} frame_gap_us {}",
+            .{bus.bus, bus.rtu.fd, config.baud, bus.rtu.frame_gap_us});
+    var polls: [2]posix.pollfd = undefined;
+    while (true)
+    {
+        const timeout = bus.sniff.timeout_ms(std.time.microTimestamp());
+        polls[0].fd = bus.wake[0];
+        polls[0].events = posix.POLL.IN;
+        polls[0].revents = 0;
+        polls[1].fd = bus.rtu.fd;
+        polls[1].events = posix.POLL.IN;
+        polls[1].revents = 0;
+        const poll_rv = try posix.poll(&polls, timeout);
+        const now_us = std.time.microTimestamp();
+        if ((poll_rv > 0) and ((polls[1].revents & posix.POLL.IN) != 0))
+        {
+            try bus.sniff.on_readable(bus.rtu.fd, now_us);
+        }
+        while (try bus.sniff.next_pair()) |pair|
+        {
+            try sniffed(bus, &pair);
+        }
+        bus.sniff.check(now_us);
+        if ((poll_rv > 0) and ((polls[0].revents & posix.POLL.IN) != 0))
+        {
+            if (try check_wake(bus))
+            {
+                return;
+            }
+            // nothing can be sent on this bus
+            fail_jobs(bus, BusError.ListenOnly);
+        }
+    }
+}
+
+//*****************************************************************************
+// wait before opening a failed bus again, returns true on quit
+fn bus_sleep(bus: *tty_bus_info_t, mstime: i64) !bool
+{
+    const end = std.time.milliTimestamp() + mstime;
+    while (true)
+    {
+        const now = std.time.milliTimestamp();
+        if (now >= end)
+        {
+            return false;
+        }
+        var polls: [1]posix.pollfd = undefined;
+        polls[0].fd = bus.wake[0];
+        polls[0].events = posix.POLL.IN;
+        polls[0].revents = 0;
+        const poll_rv = try posix.poll(&polls, @intCast(end - now));
+        if ((poll_rv > 0) and ((polls[0].revents & posix.POLL.IN) != 0))
+        {
+            if (try check_wake(bus))
+            {
+                return true;
+            }
+            // no link to put them on
+            fail_jobs(bus, BusError.BusDown);
+        }
+    }
+}
+
+//*****************************************************************************
+// a failing bus is closed and retried without stopping the others
+fn bus_thread(bus: *tty_bus_info_t) void
+{
+    tune_thread(bus) catch {};
+    while (true)
+    {
+        if (process_bus(bus)) |_|
+        {
+            break;
+        }
+        else |err|
+        {
+            log.logln(log.LogLevel.info, @src(),
+                    "bus {} error {}", .{bus.bus, err}) catch {};
+            fail_jobs(bus, BusError.BusDown);
+            const quit = bus_sleep(bus, g_retry_mstime) catch true;
+            if (quit)
+            {
+                break;
+            }
+        }
+    }
+    log.logln(log.LogLevel.info, @src(),
+            "bus {} thread exit", .{bus.bus}) catch {};
+}
+
+//*****************************************************************************
+test "0x17 split into 0x10 and 0x03, answered as 0x17"
+{
+    // read 2 at 0x0100, write 1 at 0x0200 with 0xBEEF
+    const whole = [_]u8{0x17, 0x01, 0x00, 0x00, 0x02, 0x02, 0x00, 0x00,
+            0x01, 0x02, 0xBE, 0xEF};
+    var job: tty.tty_job_t = .{.id = 1, .pdu_len = whole.len};
+    std.mem.copyForwards(u8, &job.pdu, &whole);
+    var buf: [253]u8 = undefined;
+    try std.testing.expectEqualSlices(u8, &whole, split_pdu(&job, &buf));
+    job.step = .Write;
+    try std.testing.expectEqualSlices(u8, &.{0x10, 0x02, 0x00, 0x00, 0x01,
+            0x02, 0xBE, 0xEF}, split_pdu(&job, &buf));
+    job.step = .Read;
+    try std.testing.expectEqualSlices(u8, &.{0x03, 0x01, 0x00, 0x00, 0x02},
+            split_pdu(&job, &buf));
+    // the read leg's answer, then exceptions from either leg
+    var rsp_buf: [253]u8 = undefined;
+    try std.testing.expectEqualSlices(u8, &.{0x17, 0x04, 0, 1, 0, 2},
+            split_rsp(&.{0x03, 0x04, 0, 1, 0, 2}, &rsp_buf));
+    try std.testing.expectEqualSlices(u8, &.{0x97, 0x02},
+            split_rsp(&.{0x90, 0x02}, &rsp_buf));
+    try std.testing.expectEqualSlices(u8, &.{0x97, 0x04},
+            split_rsp(&.{0x83, 0x04}, &rsp_buf));
+    try std.testing.expectEqual(@as(usize, 0),
+            split_rsp(&.{}, &rsp_buf).len);
+}
@@ -0,0 +1,310 @@
+const std = @import("std");
+const tty = @import("tty_reader.zig");
+const tty_bus = @import("tty_bus.zig");
+const rtu = @import("tty_rtu.zig");
+const provision = @import("tty_provision.zig");
+const posix = std.posix;
+
+const g_first_id: u16 = 1;
+const g_last_id: u16 = 247;
+// probe timeout before any slave has answered, and never below this
+const g_probe_floor_mstime: i64 = 40;
+// probe timeout is this times the slowest answer seen so far
+const g_probe_factor: i64 = 3;
+const g_tries: u32 = 2;
+
+const device_t = enum
+{
+    Unknown,
+    Renogy,
+    Pzem016,
+    Pzem017,
+    Sht20,
+    Relay,
+};
+
+const found_t = struct
+{
+    id: u8 = 0,
+    device: device_t = .Unknown,
+    latency_us: i64 = 0,
+    model: [16]u8 = .{0} ** 16, // Renogy only
+    model_len: usize = 0,
+};
+
+//*****************************************************************************
+fn configured(bus: *tty_bus.tty_bus_info_t, id: u16) bool
+{
+    for (bus.id_list.items) |*aitem|
+    {
+        if (aitem.id == id)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//*****************************************************************************
+// true if the probe of id got an answer from id, the crc is checked
+// before a bad response or an exception, a frame from another id is a
+// late answer to an earlier probe
+fn answered(err: ?anyerror, frame: []const u8, id: u8) bool
+{
+    const aerr = err orelse return true;
+    if ((aerr != rtu.RtuError.RtuException) and
+            (aerr != rtu.RtuError.RtuBadResponse))
+    {
+        return false;
+    }
+    return (frame.len >= 4) and (frame[0] == id);
+}
+
+//*****************************************************************************
+// true if id answered, waits one frame gap and drops what came in first
+// so a slow slave's answer to the last probe is not read as this one's
+fn probe(artu: *rtu.rtu_t, id: u8) bool
+{
+    const gap_ms: i32 = @intCast(@divTrunc(artu.frame_gap_us + 999, 1000));
+    var no_polls: [0]posix.pollfd = .{};
+    _ = posix.poll(&no_polls, gap_ms) catch {};
+    artu.flush_input();
+    var buf: [8]u8 = undefined;
+    var err: ?anyerror = null;
+    _ = provision.transact(artu, id, rtu.read_pdu(&buf, 0x04, 0, 1),
+            1) catch |aerr|
+    {
+        err = aerr;
+    };
+    return answered(err, artu.rx[0..artu.rx_len], id);
+}
+
+//*****************************************************************************
+fn read_regs(artu: *rtu.rtu_t, id: u8, function: u8, address: u16,
+        regs: []u16) bool
+{
+    var buf: [8]u8 = undefined;
+    const pdu = rtu.read_pdu(&buf, function, address, @intCast(regs.len));
+    const rsp = provision.transact(artu, id, pdu, g_tries) catch
+            return false;
+    rtu.regs_from_pdu(rsp, regs) catch return false;
+    return true;
+}
+
+//*****************************************************************************
+// renogy model is 16 ascii bytes at holding 0x000C
+fn check_renogy(artu: *rtu.rtu_t, found: *found_t) bool
+{
+    var regs: [8]u16 = undefined;
+    if (!read_regs(artu, found.id, 0x03, 0x000C, &regs))
+    {
+        return false;
+    }
+    for (regs, 0..) |areg, index|
+    {
+        std.mem.writeInt(u16, found.model[index * 2..][0..2], areg, .big);
+    }
+    var alnum: usize = 0;
+    for (&found.model) |*ach|
+    {
+        if (ach.* == 0)
+        {
+            ach.* = ' ';
+        }
+        if (!std.ascii.isPrint(ach.*))
+        {
+            return false;
+        }
+        if (std.ascii.isAlphanumeric(ach.*))
+        {
+            alnum += 1;
+        }
+    }
+    const model = std.mem.trim(u8, &found.model, " ");
+    std.mem.copyForwards(u8, &found.model, model);
+    found.model_len = model.len;
+    return alnum >= 4;
+}
+
+//*****************************************************************************
+// what kind of slave found.id is, full timeout, the probe found it
+fn fingerprint(artu: *rtu.rtu_t, found: *found_t) void
+{
+    if (check_renogy(artu, found))
+    {
+        found.device = .Renogy;
+        return;
+    }
+    var regs: [10]u16 = undefined;
+    // pzem address at holding 0x0002, the 017 has its shunt range after
+    if (read_regs(artu, found.id, 0x03, 0x0002, regs[0..1]) and
+            (regs[0] == found.id))
+    {
+        if (read_regs(artu, found.id, 0x04, 0x0000, regs[0..10]))
+        {
+            found.device = .Pzem016;
+            return;
+        }
+        if (read_regs(artu, found.id, 0x03, 0x0003, regs[0..1]) and
+                (regs[0] <= 3))
+        {
+            found.device = .Pzem017;
+            return;
+        }
+    }
+    // sht20 address at holding 0x0101 and baud code after
+    if (read_regs(artu, found.id, 0x03, 0x0101, regs[0..2]) and
+            (regs[0] == found.id) and (regs[1] <= 2))
+    {
+        found.device = .Sht20;
+        return;
+    }
+    var buf: [8]u8 = undefined;
+    const pdu = rtu.read_pdu(&buf, 0x01, 0, 8);
+    if (provision.transact(artu, found.id, pdu, g_tries)) |rsp|
+    {
+        if ((rsp.len == 3) and (rsp[1] == 1))
+        {
+            found.device = .Relay;
+        }
+    }
+    else |_| { }
+}
+
+//*****************************************************************************
+fn print_found(writer: anytype, bus: *tty_bus.tty_bus_info_t,
+        found: *const found_t) !void
+{
+    const id = found.id;
+    const lat_ms = @divTrunc(found.latency_us + 999, 1000);
+    switch (found.device)
+    {
+        .Renogy =>
+        {
+            try writer.print("# renogy {s}, answered in {} ms\n",
+                    .{found.model[0..found.model_len], lat_ms});
+            try writer.print("[id{}]\nbus={}\n", .{id, bus.bus});
+            try writer.print("[[id{}.block]]\ntype=\"holding\"\n" ++
+                    "address=256\ncount=10\n", .{id});
+            try writer.print("[[id{}.block]]\ntype=\"holding\"\n" ++
+                    "address=10\ncount=17\nstatic=true\n\n", .{id});
+        },
+        .Pzem016, .Pzem017 =>
+        {
+            const ac = found.device == .Pzem016;
+            try writer.print("# {s} pzem, answered in {} ms\n",
+                    .{if (ac) "ac" else "dc", lat_ms});
+            try writer.print("[id{}]\nbus={}\nread_input_address=0\n" ++
+                    "read_input_count={}\n\n",
+                    .{id, bus.bus, @as(u16, if (ac) 10 else 8)});
+        },
+        .Sht20 =>
+        {
+            try writer.print("# sht20 temp sensor, answered in {} ms\n",
+                    .{lat_ms});
+            try writer.print("[id{}]\nbus={}\nread_input_address=1\n" ++
+                    "read_input_count=2\nbaud_register=258\n" ++
+                    "baud_rates=[9600, 14400, 19200]\n\n", .{id, bus.bus});
+        },
+        .Relay =>
+        {
+            try writer.print("# relay board, coils 0 to 7, answered in " ++
+                    "{} ms, switch it with 0x05 through the socket\n" ++
+                    "#[id{}]\n#bus={}\n\n", .{lat_ms, id, bus.bus});
+        },
+        .Unknown =>
+        {
+            try writer.print("# unknown slave, answered in {} ms\n" ++
+                    "#[id{}]\n#bus={}\n\n", .{lat_ms, id, bus.bus});
+        },
+    }
+}
+
+//*****************************************************************************
+// probe every id, a slave that answers is fingerprinted with the full
+// timeout, the probe timeout follows the slowest answer seen so a quiet
+// id costs tens of milliseconds, not response_mstime
+fn discover_bus(writer: anytype, bus: *tty_bus.tty_bus_info_t) !void
+{
+    const config = &bus.config;
+    const full_us = config.response_mstime * 1000;
+    var artu: rtu.rtu_t = .{};
+    try provision.open_bus(&artu, bus, config.baud);
+    defer artu.close();
+    const start_mstime = std.time.milliTimestamp();
+    try writer.print("[bus{}]\ntty=\"{s}\"\nbaud={}\nparity=\"{c}\"\n\n",
+            .{bus.bus, std.mem.sliceTo(&config.tty, 0), config.baud,
+            config.parity});
+    var probe_us = @min(g_probe_floor_mstime * 1000, full_us);
+    var max_latency_us: i64 = 0;
+    var found_count: usize = 0;
+    var id = g_first_id;
+    while (id <= g_last_id) : (id += 1)
+    {
+        // configured slaves get the time they were given
+        artu.response_us = if (configured(bus, id)) full_us else probe_us;
+        if (!probe(&artu, @intCast(id)))
+        {
+            continue;
+        }
+        var found: found_t = .{.id = @intCast(id)};
+        if (artu.first_byte_us) |afirst_byte_us|
+        {
+            found.latency_us = afirst_byte_us - artu.sent_us;
+            max_latency_us = @max(max_latency_us, found.latency_us);
+            probe_us = std.math.clamp(max_latency_us * g_probe_factor,
+                    g_probe_floor_mstime * 1000, @max(full_us,
+                    g_probe_floor_mstime * 1000));
+        }
+        artu.response_us = full_us;
+        fingerprint(&artu, &found);
+        try print_found(writer, bus, &found);
+        found_count += 1;
+    }
+    try writer.print("# bus {} found {} slaves in {} ms, probe timeout " ++
+            "{} ms\n\n", .{bus.bus, found_count,
+            std.time.milliTimestamp() - start_mstime,
+            @divTrunc(probe_us, 1000)});
+}
+
+//*****************************************************************************
+// scan each rtu bus of the config and write toml for what answers,
+// tty_reader must not be running
+pub fn discover(writer: anytype, allocator: std.mem.Allocator,
+        info: *tty.tty_info_t) !void
+{
+    if (info.bus_list.items.len < 1)
+    {
+        // no [busN] and no [idN] yet, scan the [main] tty
+        const bus0 = try tty_bus.tty_bus_info_t.create(allocator, info, 0,
+                &info.defaults);
+        defer bus0.delete();
+        return discover_bus(writer, bus0);
+    }
+    for (info.bus_list.items) |abus|
+    {
+        if ((abus.config.bus_type != .Rtu) or abus.config.sniff)
+        {
+            continue;
+        }
+        try discover_bus(writer, abus);
+    }
+}
+
+//*****************************************************************************
+test "answered only credits the probed id"
+{
+    const frame = [_]u8{5, 0x04, 0x02, 0x00, 0x01, 0, 0};
+    try std.testing.expect(answered(null, &frame, 5));
+    try std.testing.expect(answered(rtu.RtuError.RtuException,
+            &.{5, 0x84, 0x02, 0, 0}, 5));
+    // id 5 answering late during the probe of id 6
+    try std.testing.expect(!answered(rtu.RtuError.RtuBadResponse,
+            &frame, 6));
+    try std.testing.expect(answered(rtu.RtuError.RtuBadResponse,
+            &frame, 5));
+    try std.testing.expect(!answered(rtu.RtuError.RtuCrcError, &frame, 5));
+    try std.testing.expect(!answered(rtu.RtuError.RtuFramingError,
+            &frame, 5));
+    try std.testing.expect(!answered(rtu.RtuError.RtuTimeout, &.{}, 5));
+}
@@ -0,0 +1,435 @@
+const std = @import("std");
+const tty = @import("tty_reader.zig");
+const tty_bus = @import("tty_bus.zig");
+
+// largest register count allowed in one read by the modbus spec
+pub const g_max_read_count: u16 = 125;
+// request frame is id, function, address, count, crc
+const g_request_bytes: u64 = 8;
+// response frame is id, function, byte count, data, crc
+const g_response_overhead_bytes: u64 = 5;
+
+//*****************************************************************************
+// start, data, parity and stop bits of one character
+pub fn frame_bits(parity: u8, data_bits: u8, stop_bits: u8) u64
+{
+    const parity_bits: u64 = if (parity == 'N') 0 else 1;
+    return 1 + @as(u64, data_bits) + parity_bits + stop_bits;
+}
+
+//*****************************************************************************
+// microseconds on the wire for byte_count characters of bits each at baud
+pub fn wire_us(baud: u32, bits: u64, byte_count: u64) u64
+{
+    if (baud < 1)
+    {
+        return 0;
+    }
+    return (byte_count * bits * 1000000) / baud;
+}
+
+//*****************************************************************************
+// modbus rtu inter frame silence, 3.5 character times, fixed at 1750 us
+// above 19200 baud
+pub fn silence_us(baud: u32, bits: u64) u64
+{
+    if (baud > 19200)
+    {
+        return 1750;
+    }
+    return (wire_us(baud, bits, 7) + 1) / 2;
+}
+
+// time one read holds the bus, the same model is used for --plan and
+// for the planned occupancy in the stats
+pub const cost_t = struct
+{
+    request_bytes: u64 = 0,
+    response_bytes: u64 = 0,
+    wire_us: u64 = 0, // both frames at the configured baud and framing
+    silence_us: u64 = 0, // 3.5 characters after each frame
+    turnaround_us: u64 = 0, // slave think time, response_floor_mstime
+    guard_us: u64 = 0, // quiet time before the next transaction
+    total_us: u64 = 0,
+};
+
+//*****************************************************************************
+fn char_bits(config: *const tty_bus.tty_bus_config_t) u64
+{
+    return frame_bits(config.parity, config.data_bits, config.stop_bits);
+}
+
+//*****************************************************************************
+pub fn read_cost(config: *const tty_bus.tty_bus_config_t, count: u16) cost_t
+{
+    var rv: cost_t = .{};
+    const ms_us: u64 = 1000;
+    switch (config.bus_type)
+    {
+        .Tcp =>
+        {
+            // mbap, function, address, count and mbap, function, byte
+            // count, data, the wire time is nothing next to the turnaround
+            rv.request_bytes = 12;
+            rv.response_bytes = 9 + @as(u64, count) * 2;
+        },
+        .Rtu, .RtuTcp =>
+        {
+            rv.request_bytes = g_request_bytes;
+            rv.response_bytes = g_response_overhead_bytes +
+                    @as(u64, count) * 2;
+            rv.wire_us = wire_us(config.baud, char_bits(config),
+                    rv.request_bytes + rv.response_bytes);
+            rv.silence_us = 2 * silence_us(config.baud, char_bits(config));
+        },
+    }
+    rv.turnaround_us = @as(u64, @intCast(@max(config.response_floor_mstime,
+            0))) * ms_us;
+    const item_us = @as(u64, @intCast(@max(config.item_mstime, 0))) * ms_us;
+    if (config.adaptive_response)
+    {
+        // the gap follows the slave's response time
+        const floor_us = @as(u64, @intCast(@max(config.gap_floor_mstime,
+                0))) * ms_us;
+        rv.guard_us = std.math.clamp(rv.turnaround_us, floor_us,
+                @max(floor_us, item_us));
+    }
+    else
+    {
+        rv.guard_us = item_us;
+    }
+    rv.total_us = rv.wire_us + rv.silence_us + rv.turnaround_us +
+            rv.guard_us;
+    return rv;
+}
+
+//*****************************************************************************
+// shortest interval a read can have, adaptive reads at their fastest,
+// null for static reads which are not polled
+pub fn plan_interval_mstime(read: *const tty.tty_read_info_t) ?i64
+{
+    if (read.static)
+    {
+        return null;
+    }
+    if (read.adapt) |aadapt|
+    {
+        return aadapt.min_interval_mstime;
+    }
+    return read.interval_mstime;
+}
+
+//*****************************************************************************
+// transactions that can share the bus at once
+pub fn lanes(config: *const tty_bus.tty_bus_config_t) f64
+{
+    if (config.bus_type == .Tcp)
+    {
+        return @floatFromInt(@max(config.max_inflight, 1));
+    }
+    return 1.0;
+}
+
+//*****************************************************************************
+// fraction of the bus the reads need, over 1.0 means intervals stretch
+pub fn occupancy(config: *const tty_bus.tty_bus_config_t,
+        reads: []const tty.tty_read_info_t) f64
+{
+    var rv: f64 = 0.0;
+    for (reads) |*read|
+    {
+        const interval_mstime = plan_interval_mstime(read) orelse continue;
+        const cost = read_cost(config, read.count);
+        rv += @as(f64, @floatFromInt(cost.total_us)) /
+                @as(f64, @floatFromInt(@max(interval_mstime, 1) * 1000));
+    }
+    return rv / lanes(config);
+}
+
+//*****************************************************************************
+// time to do every polled read once, back to back, an interval shorter
+// than this is late whenever everything is due together
+pub fn cycle_us(config: *const tty_bus.tty_bus_config_t,
+        reads: []const tty.tty_read_info_t) u64
+{
+    var rv: u64 = 0;
+    for (reads) |*read|
+    {
+        if (plan_interval_mstime(read) == null)
+        {
+            continue;
+        }
+        rv += read_cost(config, read.count).total_us;
+    }
+    const lane_count: u64 = @intFromFloat(lanes(config));
+    return (rv + lane_count - 1) / lane_count;
+}
+
+//*****************************************************************************
+// tty_reader --plan, the timing model of every bus
+pub fn print_plan(writer: anytype, bus: *tty_bus.tty_bus_info_t) !void
+{
+    const config = &bus.config;
+    const reads = bus.read_list.items;
+    try writer.print("bus {} {s} baud {} {}{c}{} item_mstime {} " ++
+            "response_floor_mstime {} adaptive_response {}\n",
+            .{bus.bus, @tagName(config.bus_type), config.baud,
+            config.data_bits, config.parity, config.stop_bits,
+            config.item_mstime, config.response_floor_mstime,
+            config.adaptive_response});
+    const cycle = cycle_us(config, reads);
+    for (reads) |*read|
+    {
+        const cost = read_cost(config, read.count);
+        try writer.print("  id {} type {} address {} count {} " ++
+                "bytes {}/{} wire_us {} silence_us {} turnaround_us {} " ++
+                "guard_us {} total_us {}",
+                .{read.id, read.reg_type, read.address, read.count,
+                cost.request_bytes, cost.response_bytes, cost.wire_us,
+                cost.silence_us, cost.turnaround_us, cost.guard_us,
+                cost.total_us});
+        if (plan_interval_mstime(read)) |ainterval_mstime|
+        {
+            const interval_us: u64 = @intCast(@max(ainterval_mstime, 0) *
+                    1000);
+            try writer.print(" interval_mstime {}", .{ainterval_mstime});
+            if (interval_us < cost.total_us)
+            {
+                try writer.print(" INFEASIBLE, longer than its interval",
+                        .{});
+            }
+            else if (interval_us < cycle)
+            {
+                try writer.print(" late when all reads are due together",
+                        .{});
+            }
+            try writer.print("\n", .{});
+        }
+        else
+        {
+            try writer.print(" static\n", .{});
+        }
+    }
+    const busy = occupancy(config, reads);
+    try writer.print("  cycle_mstime {} occupancy {d:.1}%{s}\n",
+            .{(cycle + 999) / 1000, busy * 100.0,
+            if (busy > 1.0) " OVERLOADED, intervals will stretch" else ""});
+}
+
+//*****************************************************************************
+// true if reading gap unused registers is cheaper than a second round
+// trip, both from read_cost, a round trip is the frames, silences,
+// turnaround and guard of a read with no registers
+fn gap_is_cheaper(config: *const tty_bus.tty_bus_config_t, max_gap: u16,
+        gap: u16) bool
+{
+    if (gap > max_gap)
+    {
+        return false;
+    }
+    const transaction_us = read_cost(config, 0).total_us;
+    const over_us = read_cost(config, gap).total_us - transaction_us;
+    return over_us < transaction_us;
+}
+
+//*****************************************************************************
+// deadline of a merged read, the tighter of the two, null if neither
+// block has one
+fn tighter(a: ?i64, b: ?i64, interval_mstime: i64) ?i64
+{
+    if ((a == null) and (b == null))
+    {
+        return null;
+    }
+    return @min(a orelse interval_mstime, b orelse interval_mstime);
+}
+
+//*****************************************************************************
+// adaptive blocks go last so they do not split the groups the others
+// merge in
+fn block_less_than(_: void, a: tty.tty_block_info_t,
+        b: tty.tty_block_info_t) bool
+{
+    if ((a.adapt == null) != (b.adapt == null))
+    {
+        return a.adapt == null;
+    }
+    if (a.reg_type != b.reg_type)
+    {
+        return a.reg_type < b.reg_type;
+    }
+    if (a.interval_mstime.? != b.interval_mstime.?)
+    {
+        return a.interval_mstime.? < b.interval_mstime.?;
+    }
+    if (a.align_to_clock.? != b.align_to_clock.?)
+    {
+        return !a.align_to_clock.?;
+    }
+    if (a.static != b.static)
+    {
+        return !a.static;
+    }
+    if (a.address != b.address)
+    {
+        return a.address < b.address;
+    }
+    return a.count > b.count;
+}
+
+//*****************************************************************************
+// merge the register blocks of every device into the fewest reads, a
+// block is never split across reads and only blocks polled at the same
+// interval are merged, bus timing decides what a gap costs
+pub fn plan_reads(allocator: *const std.mem.Allocator,
+        bus: *tty_bus.tty_bus_info_t) !void
+{
+    const config = &bus.config;
+    bus.read_list.clearRetainingCapacity();
+    for (bus.id_list.items, 0..) |*id_info, id_index|
+    {
+        const blocks = id_info.blocks.items;
+        for (blocks) |*block|
+        {
+            block.interval_mstime = block.interval_mstime orelse
+                    id_info.interval_mstime orelse config.list_mstime;
+            block.priority = block.priority orelse id_info.priority orelse 0;
+            block.align_to_clock = block.align_to_clock orelse
+                    id_info.align_to_clock orelse config.align_to_clock;
+            block.deadline_mstime = block.deadline_mstime orelse
+                    id_info.deadline_mstime;
+        }
+        std.mem.sort(tty.tty_block_info_t, blocks, {}, block_less_than);
+        const max_gap = id_info.merge_gap orelse config.merge_gap;
+        var index: usize = 0;
+        while (index < blocks.len)
+        {
+            var read: tty.tty_read_info_t = .{
+                .id = id_info.id,
+                .reg_type = blocks[index].reg_type,
+                .address = blocks[index].address,
+                .count = blocks[index].count,
+                .id_index = id_index,
+                .block_index = index,
+                .block_count = 1,
+                .interval_mstime = blocks[index].interval_mstime.?,
+                .priority = blocks[index].priority.?,
+                .align_to_clock = blocks[index].align_to_clock.?,
+                .deadline_mstime = blocks[index].deadline_mstime,
+                .static = blocks[index].static,
+                .adapt = blocks[index].adapt,
+            };
+            if (read.adapt) |aadapt|
+            {
+                // adaptive reads start slow and are not clock aligned
+                read.interval_mstime = aadapt.max_interval_mstime;
+                read.align_to_clock = false;
+            }
+            index += 1;
+            while ((index < blocks.len) and (read.adapt == null))
+            {
+                const block = &blocks[index];
+                if ((block.adapt != null) or
+                        (block.reg_type != read.reg_type) or
+                        (block.interval_mstime.? != read.interval_mstime) or
+                        (block.align_to_clock.? != read.align_to_clock) or
+                        (block.static != read.static))
+                {
+                    break;
+                }
+                const read_end: u32 = @as(u32, read.address) + read.count;
+                const block_end: u32 = @as(u32, block.address) + block.count;
+                const new_end = @max(read_end, block_end);
+                if (new_end - read.address > g_max_read_count)
+                {
+                    break;
+                }
+                if (block.address > read_end)
+                {
+                    const gap: u16 = @intCast(block.address - read_end);
+                    if (!gap_is_cheaper(config, max_gap, gap))
+                    {
+                        break;
+                    }
+                }
+                read.count = @intCast(new_end - read.address);
+                read.block_count += 1;
+                read.priority = @max(read.priority, block.priority.?);
+                read.deadline_mstime = tighter(read.deadline_mstime,
+                        block.deadline_mstime, read.interval_mstime);
+                index += 1;
+            }
+            try bus.read_list.append(allocator.*, read);
+        }
+    }
+}
+
+//*****************************************************************************
+test "plan_reads merges gaps, skips adaptive blocks"
+{
+    const allocator = std.testing.allocator;
+    var bus: tty_bus.tty_bus_info_t = .{};
+    defer bus.id_list.deinit(allocator);
+    defer bus.read_list.deinit(allocator);
+    // 9600 8N1, a 16 register gap is cheaper than a round trip
+    var id_info: tty.tty_id_info_t = .{.id = 1, .interval_mstime = 1000};
+    defer id_info.blocks.deinit(allocator);
+    try id_info.blocks.append(allocator, .{.address = 40, .count = 2});
+    try id_info.blocks.append(allocator, .{.address = 14, .count = 2});
+    try id_info.blocks.append(allocator, .{.address = 13, .count = 1,
+            .adapt = .{}});
+    try id_info.blocks.append(allocator, .{.address = 10, .count = 2});
+    try id_info.blocks.append(allocator, .{.address = 0, .count = 4});
+    try bus.id_list.append(allocator, id_info);
+    try plan_reads(&allocator, &bus);
+    const reads = bus.read_list.items;
+    try std.testing.expectEqual(@as(usize, 3), reads.len);
+    // 0..3, 10..11 and 14..15 around the adaptive 13
+    try std.testing.expectEqual(@as(u16, 0), reads[0].address);
+    try std.testing.expectEqual(@as(u16, 16), reads[0].count);
+    try std.testing.expectEqual(@as(usize, 3), reads[0].block_count);
+    // 24 unused registers is past merge_gap
+    try std.testing.expectEqual(@as(u16, 40), reads[1].address);
+    try std.testing.expectEqual(@as(u16, 2), reads[1].count);
+    try std.testing.expectEqual(@as(u16, 13), reads[2].address);
+    try std.testing.expectEqual(@as(u16, 1), reads[2].count);
+    try std.testing.expect(reads[2].adapt != null);
+}
+
+//*****************************************************************************
+test "gap_is_cheaper follows the bus timing"
+{
+    var config: tty_bus.tty_bus_config_t = .{};
+    // 9600 8N1, a round trip is about 40 ms, 19 registers on the wire
+    try std.testing.expect(gap_is_cheaper(&config, 125, 8));
+    try std.testing.expect(!gap_is_cheaper(&config, 125, 100));
+    // never past max_gap
+    try std.testing.expect(!gap_is_cheaper(&config, 4, 8));
+    // even parity makes each register cost more
+    config.parity = 'E';
+    const even = read_cost(&config, 10).wire_us;
+    config.parity = 'N';
+    try std.testing.expect(even > read_cost(&config, 10).wire_us);
+}
+
+//*****************************************************************************
+test "wire and silence time follow the character framing"
+{
+    const bits_8n1 = frame_bits('N', 8, 1);
+    const bits_8e2 = frame_bits('E', 8, 2);
+    try std.testing.expectEqual(@as(u64, 10), bits_8n1);
+    try std.testing.expectEqual(@as(u64, 12), bits_8e2);
+    // 8 bytes at 9600
+    try std.testing.expectEqual(@as(u64, 8333), wire_us(9600, bits_8n1, 8));
+    try std.testing.expectEqual(@as(u64, 10000), wire_us(9600, bits_8e2, 8));
+    try std.testing.expectEqual(@as(u64, 3646), silence_us(9600, bits_8n1));
+    try std.testing.expectEqual(@as(u64, 4375), silence_us(9600, bits_8e2));
+    try std.testing.expectEqual(@as(u64, 1750), silence_us(38400, bits_8e2));
+    // the cost model agrees
+    const config: tty_bus.tty_bus_config_t = .{.parity = 'E', .stop_bits = 2};
+    const cost = read_cost(&config, 1);
+    try std.testing.expectEqual(wire_us(9600, bits_8e2, 8 + 7),
+            cost.wire_us);
+    try std.testing.expectEqual(2 * silence_us(9600, bits_8e2),
+            cost.silence_us);
+}
@@ -0,0 +1,467 @@
+const std = @import("std");
+const log = @import("log");
+const tty = @import("tty_reader.zig");
+const tty_bus = @import("tty_bus.zig");
+const rtu = @import("tty_rtu.zig");
+const posix = std.posix;
+
+pub const ProvisionError = error
+{
+    BaudNotSupported,
+    NoBaudCode,
+    VerifyFailed,
+};
+
+const g_tries: u32 = 3;
+const g_max_config_size: usize = 1024 * 1024;
+
+//*****************************************************************************
+// code to write to baud_register for baud, null if the slave can not
+fn baud_code(item: *const tty.tty_id_info_t, baud: u32) ?u16
+{
+    if (item.baud_register == null)
+    {
+        return null;
+    }
+    for (item.baud_rates[0..item.baud_rates_count], 0..) |abaud, index|
+    {
+        if (abaud == baud)
+        {
+            return @intCast(index);
+        }
+    }
+    return null;
+}
+
+//*****************************************************************************
+// one request, blocks until the response or tries timeouts, the
+// returned pdu is valid until the next call, also used by --discover
+pub fn transact(artu: *rtu.rtu_t, id: u8, pdu: []const u8,
+        tries: u32) ![]const u8
+{
+    var tried: u32 = 0;
+    while (true)
+    {
+        var now_us = std.time.microTimestamp();
+        try artu.start(id, pdu, now_us);
+        while (artu.state != .Done)
+        {
+            var polls = [1]posix.pollfd{.{.fd = artu.fd,
+                    .events = artu.poll_events(), .revents = 0}};
+            _ = try posix.poll(&polls, artu.timeout_ms(now_us));
+            now_us = std.time.microTimestamp();
+            if ((polls[0].revents & posix.POLL.IN) != 0)
+            {
+                try artu.on_readable(now_us);
+            }
+            if ((polls[0].revents & posix.POLL.OUT) != 0)
+            {
+                try artu.on_writable(now_us);
+            }
+            try artu.check(now_us);
+        }
+        artu.reset();
+        if (artu.err) |aerr|
+        {
+            tried += 1;
+            if ((aerr == rtu.RtuError.RtuException) or (tried >= tries))
+            {
+                return aerr;
+            }
+            continue;
+        }
+        return artu.pdu();
+    }
+}
+
+//*****************************************************************************
+fn read_code(artu: *rtu.rtu_t, id: u8, address: u16) !u16
+{
+    var buf: [8]u8 = undefined;
+    const rsp = try transact(artu, id, rtu.read_pdu(&buf, 0x03, address, 1),
+            g_tries);
+    var regs: [1]u16 = undefined;
+    try rtu.regs_from_pdu(rsp, &regs);
+    return regs[0];
+}
+
+//*****************************************************************************
+fn write_code(artu: *rtu.rtu_t, id: u8, address: u16, code: u16) !void
+{
+    var buf: [5]u8 = undefined;
+    buf[0] = 0x06;
+    std.mem.writeInt(u16, buf[1..3], address, .big);
+    std.mem.writeInt(u16, buf[3..5], code, .big);
+    const rsp = try transact(artu, id, &buf, g_tries);
+    if (!std.mem.eql(u8, rsp, &buf))
+    {
+        return rtu.RtuError.RtuBadResponse;
+    }
+}
+
+//*****************************************************************************
+pub fn open_bus(artu: *rtu.rtu_t, bus: *tty_bus.tty_bus_info_t,
+        baud: u32) !void
+{
+    const config = &bus.config;
+    try artu.open(std.mem.sliceTo(&config.tty, 0), baud, config.parity,
+            config.data_bits, config.stop_bits);
+    artu.response_us = config.response_mstime * 1000;
+}
+
+// where a slave is while provisioning, unknown is written but not
+// verified, it may have switched before or after its echo
+const baud_state_t = enum
+{
+    Old,
+    New,
+    Unknown,
+};
+
+//*****************************************************************************
+// put the first states.len slaves of bus back to old_codes, best effort,
+// New ones answer at baud, Unknown ones are tried at both, Old ones
+// are left alone
+fn roll_back(bus: *tty_bus.tty_bus_info_t, baud: u32,
+        states: []baud_state_t, old_codes: []const u16) !void
+{
+    var artu: rtu.rtu_t = .{};
+    for ([_]bool{true, false}) |at_new|
+    {
+        const at_baud = if (at_new) baud else bus.config.baud;
+        open_bus(&artu, bus, at_baud) catch |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} open at {} failed {}", .{bus.bus, at_baud, err});
+            continue;
+        };
+        defer artu.close();
+        for (bus.id_list.items[0..states.len], 0..) |*aitem, index|
+        {
+            const state = states[index];
+            if ((state == .Old) or ((state == .New) and !at_new))
+            {
+                continue;
+            }
+            write_code(&artu, aitem.id, aitem.baud_register.?,
+                    old_codes[index]) catch continue;
+            states[index] = .Old;
+        }
+    }
+    for (bus.id_list.items[0..states.len], states) |*aitem, astate|
+    {
+        if (astate != .Old)
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} id {} roll back failed, not answering at " ++
+                    "{} or {}", .{bus.bus, aitem.id, baud,
+                    bus.config.baud});
+        }
+    }
+}
+
+//*****************************************************************************
+// move every slave on bus to baud, all or nothing, a bus is one speed
+fn provision_bus(allocator: std.mem.Allocator, bus: *tty_bus.tty_bus_info_t,
+        baud: u32) !void
+{
+    const count = bus.id_list.items.len;
+    for (bus.id_list.items) |*aitem|
+    {
+        if (baud_code(aitem, baud) == null)
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} id {} has no baud code for {}",
+                    .{bus.bus, aitem.id, baud});
+            return ProvisionError.NoBaudCode;
+        }
+    }
+    const old_codes = try allocator.alloc(u16, count);
+    defer allocator.free(old_codes);
+    const states = try allocator.alloc(baud_state_t, count);
+    defer allocator.free(states);
+    @memset(states, .Old);
+    var artu: rtu.rtu_t = .{};
+    // everyone has to answer before anything changes
+    try open_bus(&artu, bus, bus.config.baud);
+    for (bus.id_list.items, 0..) |*aitem, index|
+    {
+        old_codes[index] = read_code(&artu, aitem.id,
+                aitem.baud_register.?) catch |err|
+        {
+            artu.close();
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} id {} read of baud register failed {}",
+                    .{bus.bus, aitem.id, err});
+            return err;
+        };
+    }
+    // a failed write may still have switched the slave, it is rolled
+    // back too
+    var written: usize = 0;
+    for (bus.id_list.items, 0..) |*aitem, index|
+    {
+        states[index] = .Unknown;
+        written += 1;
+        write_code(&artu, aitem.id, aitem.baud_register.?,
+                baud_code(aitem, baud).?) catch |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} id {} write of baud register failed {}",
+                    .{bus.bus, aitem.id, err});
+            break;
+        };
+    }
+    artu.close();
+    // verify at the new baud
+    var verified: usize = 0;
+    if (written == count)
+    {
+        if (open_bus(&artu, bus, baud)) |_|
+        {
+            defer artu.close();
+            verified = try verify(&artu, bus, baud, states);
+        }
+        else |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} open at {} failed {}", .{bus.bus, baud, err});
+        }
+    }
+    if (verified != count)
+    {
+        try roll_back(bus, baud, states[0..written], old_codes[0..written]);
+        return ProvisionError.VerifyFailed;
+    }
+    try log.logln(log.LogLevel.info, @src(),
+            "bus {} {} slaves now at {}", .{bus.bus, count, baud});
+}
+
+//*****************************************************************************
+// read back each baud code at baud, a slave that answers is New,
+// returns how many have the right code
+fn verify(artu: *rtu.rtu_t, bus: *tty_bus.tty_bus_info_t, baud: u32,
+        states: []baud_state_t) !usize
+{
+    var verified: usize = 0;
+    for (bus.id_list.items, 0..) |*aitem, index|
+    {
+        const code = read_code(artu, aitem.id,
+                aitem.baud_register.?) catch |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} id {} not answering at {} {}, some " ++
+                    "slaves need a power cycle to change baud",
+                    .{bus.bus, aitem.id, baud, err});
+            continue;
+        };
+        states[index] = .New;
+        if (code == baud_code(aitem, baud).?)
+        {
+            verified += 1;
+        }
+    }
+    return verified;
+}
+
+//*****************************************************************************
+// true if line is the header [name]
+fn is_header(line: []const u8, name: []const u8) bool
+{
+    const trimmed = std.mem.trim(u8, line, " \t\r");
+    return (trimmed.len == name.len + 2) and (trimmed[0] == '[') and
+            (trimmed[trimmed.len - 1] == ']') and
+            std.mem.eql(u8, trimmed[1..trimmed.len - 1], name);
+}
+
+//*****************************************************************************
+// true if line sets key
+fn is_key(line: []const u8, key: []const u8) bool
+{
+    const trimmed = std.mem.trimLeft(u8, line, " \t");
+    if (!std.mem.startsWith(u8, trimmed, key))
+    {
+        return false;
+    }
+    const rest = std.mem.trimLeft(u8, trimmed[key.len..], " \t");
+    return (rest.len > 0) and (rest[0] == '=');
+}
+
+//*****************************************************************************
+// data with baud= set in [busN], appended to out, comments and the rest
+// of the file stay as they are
+fn set_baud(allocator: std.mem.Allocator, data: []const u8, bus_num: u8,
+        baud: u32, out: *std.ArrayListUnmanaged(u8)) !void
+{
+    var name_buf: [16]u8 = undefined;
+    const name = try std.fmt.bufPrint(&name_buf, "bus{}", .{bus_num});
+    var line_buf: [32]u8 = undefined;
+    const baud_line = try std.fmt.bufPrint(&line_buf, "baud={}\n", .{baud});
+    var in_bus = false;
+    var done = false;
+    var lines = std.mem.splitScalar(u8, data, '\n');
+    while (lines.next()) |aline|
+    {
+        if ((lines.index == null) and (aline.len == 0))
+        {
+            break; // after the last newline
+        }
+        const trimmed = std.mem.trimLeft(u8, aline, " \t");
+        if (in_bus and (trimmed.len > 0) and (trimmed[0] == '['))
+        {
+            // [busN] ended without baud=
+            try out.appendSlice(allocator, baud_line);
+            in_bus = false;
+            done = true;
+        }
+        if (in_bus and is_key(aline, "baud"))
+        {
+            try out.appendSlice(allocator, baud_line);
+            in_bus = false;
+            done = true;
+            continue;
+        }
+        try out.appendSlice(allocator, aline);
+        try out.append(allocator, '\n');
+        if (!done and is_header(aline, name))
+        {
+            in_bus = true;
+        }
+    }
+    if (in_bus)
+    {
+        try out.appendSlice(allocator, baud_line);
+    }
+    else if (!done)
+    {
+        // bus0 from [main], give it its own section
+        try out.appendSlice(allocator, "\n[");
+        try out.appendSlice(allocator, name);
+        try out.appendSlice(allocator, "]\n");
+        try out.appendSlice(allocator, baud_line);
+    }
+}
+
+//*****************************************************************************
+// set baud= in [busN] of config_file in dir, the file as it was before
+// the first rewrite is kept as .bak, later ones leave it alone
+fn rewrite_config(allocator: std.mem.Allocator, dir: std.fs.Dir,
+        config_file: []const u8, bus_num: u8, baud: u32, first: bool) !void
+{
+    const data = try dir.readFileAlloc(allocator, config_file,
+            g_max_config_size);
+    defer allocator.free(data);
+    var out: std.ArrayListUnmanaged(u8) = .{};
+    defer out.deinit(allocator);
+    try set_baud(allocator, data, bus_num, baud, &out);
+    var path_buf: [std.fs.max_path_bytes]u8 = undefined;
+    const new_path = try std.fmt.bufPrint(&path_buf, "{s}.new",
+            .{config_file});
+    try dir.writeFile(.{.sub_path = new_path, .data = out.items});
+    if (first)
+    {
+        var bak_buf: [std.fs.max_path_bytes]u8 = undefined;
+        const bak_path = try std.fmt.bufPrint(&bak_buf, "{s}.bak",
+                .{config_file});
+        try dir.copyFile(config_file, dir, bak_path, .{});
+    }
+    try dir.rename(new_path, config_file);
+}
+
+//*****************************************************************************
+// move the slaves of each rtu bus to baud, a bus with a slave that can
+// not do baud is left alone, tty_reader must not be running
+pub fn provision(allocator: std.mem.Allocator, info: *tty.tty_info_t,
+        config_file: []const u8, baud: u32) !void
+{
+    if (!rtu.baud_ok(baud))
+    {
+        try log.logln(log.LogLevel.info, @src(),
+                "baud {} not supported by the tty", .{baud});
+        return ProvisionError.BaudNotSupported;
+    }
+    var failed = false;
+    var rewritten = false;
+    for (info.bus_list.items) |abus|
+    {
+        if ((abus.config.bus_type != .Rtu) or abus.config.sniff or
+                (abus.config.baud == baud) or (abus.id_list.items.len < 1))
+        {
+            continue;
+        }
+        provision_bus(allocator, abus, baud) catch |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "bus {} left at {} {}",
+                    .{abus.bus, abus.config.baud, err});
+            failed = true;
+            continue;
+        };
+        // each bus is written as soon as it moved, the .bak once
+        try rewrite_config(allocator, std.fs.cwd(), config_file, abus.bus,
+                baud, !rewritten);
+        rewritten = true;
+        try log.logln(log.LogLevel.info, @src(),
+                "[bus{}] baud={} written to {s}, old file in {s}.bak",
+                .{abus.bus, baud, config_file, config_file});
+        abus.config.baud = baud;
+    }
+    if (failed)
+    {
+        return ProvisionError.VerifyFailed;
+    }
+}
+
+//*****************************************************************************
+fn test_set_baud(data: []const u8, bus_num: u8, baud: u32,
+        expected: []const u8) !void
+{
+    const allocator = std.testing.allocator;
+    var out: std.ArrayListUnmanaged(u8) = .{};
+    defer out.deinit(allocator);
+    try set_baud(allocator, data, bus_num, baud, &out);
+    try std.testing.expectEqualStrings(expected, out.items);
+}
+
+//*****************************************************************************
+test "set_baud replaces, adds or appends baud= for the bus"
+{
+    // replaced in place, comments and other buses untouched
+    try test_set_baud(
+            "# tty0\n[bus0]\nbaud = 9600 # old\n[bus1]\nbaud=9600\n",
+            0, 19200,
+            "# tty0\n[bus0]\nbaud=19200\n[bus1]\nbaud=9600\n");
+    // [bus1] had no baud=, added before the next section
+    try test_set_baud("[bus1]\ntty=\"/dev/ttyUSB1\"\n[bus2]\n", 1, 38400,
+            "[bus1]\ntty=\"/dev/ttyUSB1\"\nbaud=38400\n[bus2]\n");
+    // last section, added at the end
+    try test_set_baud("[bus1]\ntty=\"/dev/ttyUSB1\"\n", 1, 38400,
+            "[bus1]\ntty=\"/dev/ttyUSB1\"\nbaud=38400\n");
+    // bus0 from [main] gets its own section
+    try test_set_baud("[main]\nbaud=9600\n", 0, 19200,
+            "[main]\nbaud=9600\n\n[bus0]\nbaud=19200\n");
+    // baudrate= is not baud=
+    try test_set_baud("[bus0]\nbaudrate=1\n", 0, 19200,
+            "[bus0]\nbaudrate=1\nbaud=19200\n");
+}
+
+//*****************************************************************************
+test "rewrite_config keeps the original as .bak"
+{
+    const allocator = std.testing.allocator;
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const original = "[bus0]\nbaud=9600\n[bus1]\nbaud=9600\n";
+    try tmp.dir.writeFile(.{.sub_path = "tty0.toml", .data = original});
+    try rewrite_config(allocator, tmp.dir, "tty0.toml", 0, 19200, true);
+    try rewrite_config(allocator, tmp.dir, "tty0.toml", 1, 19200, false);
+    const bak = try tmp.dir.readFileAlloc(allocator, "tty0.toml.bak",
+            g_max_config_size);
+    defer allocator.free(bak);
+    try std.testing.expectEqualStrings(original, bak);
+    const data = try tmp.dir.readFileAlloc(allocator, "tty0.toml",
+            g_max_config_size);
+    defer allocator.free(data);
+    try std.testing.expectEqualStrings(
+            "[bus0]\nbaud=19200\n[bus1]\nbaud=19200\n", data);
+}
@@ -2,44 +2,159 @@
 const std = @import("std");
 const builtin = @import("builtin");
 const log = @import("log");
-const hexdump = @import("hexdump");
 const parse = @import("parse");
 const git = @import("git.zig");
 const toml  = @import("tty_toml.zig");
+const plan = @import("tty_plan.zig");
+const rt = @import("tty_rt.zig");
+const provision = @import("tty_provision.zig");
+const discover = @import("tty_discover.zig");
+const uring = @import("tty_uring.zig");
+const sched = @import("tty_sched.zig");
+const tty_bus = @import("tty_bus.zig");
+const slave = @import("tty_slave.zig");
 const net = std.net;
 const posix = std.posix;
-const c = @cImport(
-{
-    @cInclude("modbus/modbus.h");
-});
+const linux = std.os.linux;
 
 var g_allocator: std.mem.Allocator = std.heap.c_allocator;
 var g_term: [2]i32 = .{-1, -1};
 var g_hup: [2]i32 = .{-1, -1};
-const g_tty_name_max_length = 128;
+var g_usr1: [2]i32 = .{-1, -1};
+const g_tty_name_max_length = tty_bus.g_tty_name_max_length;
 var g_deamonize: bool = false;
+var g_plan: bool = false;
+var g_provision_baud: u32 = 0; // --provision, 0 is off
+var g_discover: bool = false;
+var g_io_uring: bool = false;
 var g_config_file: [128:0]u8 =
         .{'t', 't', 'y', '0', '.', 't', 'o', 'm', 'l'} ++ .{0} ** 119;
 
 pub const TtyError = error
 {
     TermSet,
-    ModbusSetSlaveFailed,
-    ModbusReadRegistersFailed,
-    ModbusReadInputRegistersFailed,
-    ModbusSetErrorRecoveryFailed,
-    ModbusGetResponseTimeoutFailed,
-    ModbusConnectFailed,
-    ModbusSetDebugFailed,
     PeerNotFound,
     ShowCommandLine,
+    BadMsg,
 };
 
-const send_t = struct
+// largest message, g_msg_response with a 253 byte pdu
+const g_msg_max: usize = 512;
+// free messages kept for reuse, more than this are freed
+const g_msg_pool_max: usize = 256;
+// most queued messages handed to one sendmsg
+const g_max_iov: usize = 64;
+// events taken from one epoll_wait
+const g_max_events: usize = 64;
+
+// encoded once on a bus thread, the peers that send it and the cache
+// hold references, back to tty_info_t.msg_pool when the last one is
+// released, refs is touched by the bus thread until the message is
+// queued, then only on the main thread
+const tty_msg_t = struct
 {
-    sent: usize = 0,
-    out_data_slice: []u8,
-    next: ?*send_t = null,
+    s: *parse.parse_t, // g_msg_max bytes, kept while pooled
+    data: []u8 = &.{}, // encoded message in s
+    refs: u32 = 0,
+    peer_id: u32 = 0, // only to this peer, 0 is every peer
+    mstime: i64 = 0, // when it was read, g_msg_regs
+    // what peer filters look at, g_msg_regs and g_msg_status
+    code: u16 = 0,
+    id: u8 = 0,
+    reg_type: u16 = 0,
+    address: u16 = 0,
+    count: u16 = 0,
+    next: ?*tty_msg_t = null,
+};
+
+// a bit for each slave id
+const tty_id_set_t = std.bit_set.ArrayBitSet(u32, 256);
+
+const tty_range_t = struct // from g_msg_subscribe
+{
+    id: u8 = 0,
+    reg_type: u16 = g_reg_type_any,
+    address: u16 = 0,
+    count: u16 = 0, // 0 is every register
+};
+
+// what a peer asked for with g_msg_subscribe, everything until it does
+const tty_filter_t = struct
+{
+    subscribed: bool = false,
+    codes: u16 = 0, // a bit for each message code
+    ids: tty_id_set_t = tty_id_set_t.initEmpty(), // ids in ranges
+    ranges: std.ArrayListUnmanaged(tty_range_t) = .{}, // empty is every id
+
+    //*************************************************************************
+    fn deinit(self: *tty_filter_t) void
+    {
+        self.ranges.deinit(g_allocator);
+    }
+
+    //*************************************************************************
+    // true if the peer gets msg, answers to its own requests always
+    fn wants(self: *tty_filter_t, msg: *tty_msg_t) bool
+    {
+        if (!self.subscribed or (msg.peer_id != 0))
+        {
+            return true;
+        }
+        if ((msg.code > 15) or
+                (((self.codes >> @intCast(msg.code)) & 1) == 0))
+        {
+            return false;
+        }
+        if (self.ranges.items.len < 1)
+        {
+            return true;
+        }
+        if (!self.ids.isSet(msg.id))
+        {
+            return false;
+        }
+        for (self.ranges.items) |arange|
+        {
+            if ((arange.id != msg.id) or ((arange.reg_type != g_reg_type_any)
+                    and (arange.reg_type != msg.reg_type)))
+            {
+                continue;
+            }
+            if (arange.count == 0)
+            {
+                return true;
+            }
+            const start: u32 = arange.address;
+            const end: u32 = start + arange.count;
+            const msg_start: u32 = msg.address;
+            const msg_end: u32 = msg_start + @max(msg.count, 1);
+            if ((start < msg_end) and (msg_start < end))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //*************************************************************************
+    // ids this filter can let messages with code through for, none when
+    // the code is not subscribed, all when not narrowed by id
+    fn want_ids(self: *tty_filter_t, code: u16) tty_id_set_t
+    {
+        if (!self.subscribed)
+        {
+            return tty_id_set_t.initFull();
+        }
+        if ((code > 15) or (((self.codes >> @intCast(code)) & 1) == 0))
+        {
+            return tty_id_set_t.initEmpty();
+        }
+        if (self.ranges.items.len < 1)
+        {
+            return tty_id_set_t.initFull();
+        }
+        return self.ids;
+    }
 };
 
 //*****************************************************************************
@@ -50,11 +165,24 @@ inline fn err_if(b: bool, err: TtyError) !void
 
 const tty_peer_info_t = struct // one for each client connected
 {
-    delme: bool = false,
     sck: i32 = -1,
-    send_head: ?*send_t = null,
-    send_tail: ?*send_t = null,
+    out_armed: bool = false, // registered for EPOLL.OUT, has a backlog
+    dirty: bool = false, // in tty_info_t.dirty, io_uring only
+    peer_id: u32 = 0, // unique for the life of tty_reader, jobs refer to it
+    // messages to send, sends.items[send_index] is sent up to sent bytes
+    sends: std.ArrayListUnmanaged(*tty_msg_t) = .{},
+    send_index: usize = 0,
+    sent: usize = 0,
+    // the backlog as one sendmsg, see fill_send
+    iovs: [g_max_iov]posix.iovec_const = undefined,
+    msghdr: posix.msghdr_const = undefined,
     ins: *parse.parse_t = undefined,
+    // messages in, 4 byte code and size header then the rest
+    readed: usize = 0,
+    to_read: usize = 4,
+    code: u16 = 0,
+    size: u16 = 0,
+    filter: tty_filter_t = .{},
 
     //*************************************************************************
     fn init(self: *tty_peer_info_t) !void
@@ -64,101 +192,394 @@ const tty_peer_info_t = struct // one for each client connected
     }
 
     //*************************************************************************
-    fn deinit(self: *tty_peer_info_t) void
+    fn deinit(self: *tty_peer_info_t, info: *tty_info_t) void
     {
-        var send = self.send_head;
-        while (send) |asend|
+        for (self.sends.items[self.send_index..]) |amsg|
         {
-            send = asend.next;
-            g_allocator.free(asend.out_data_slice);
-            g_allocator.destroy(asend);
+            info.release_msg(amsg);
         }
+        self.sends.deinit(g_allocator);
+        self.filter.deinit();
         posix.close(self.sck);
         self.ins.delete();
     }
 
+    //*************************************************************************
+    fn has_sends(self: *tty_peer_info_t) bool
+    {
+        return self.send_index < self.sends.items.len;
+    }
+
+};
+
+pub const g_reg_type_holding: u8 = 0;
+pub const g_reg_type_input: u8 = 1;
+pub const g_reg_type_any: u16 = 0xFFFF; // g_msg_subscribe only
+
+// message ids, first u16 of every message to the peers
+pub const g_msg_regs: u16 = 0; // register values
+pub const g_msg_status: u16 = 1; // a read failed or a slave changed health
+pub const g_msg_request: u16 = 2; // from a peer, a modbus pdu for one slave
+pub const g_msg_response: u16 = 3; // to the peer that sent the request
+// from a peer, message codes as a bit mask, range count, then for each
+// range id, type, address and count, replaces what the peer had, no
+// ranges is every id, count 0 is every register, type g_reg_type_any is
+// both types
+pub const g_msg_subscribe: u16 = 4;
+// to a peer, the cached g_msg_regs of a block, age in milliseconds then
+// the same as g_msg_regs after the size
+pub const g_msg_cached: u16 = 5;
+// from a peer, range count and ranges as g_msg_subscribe, answered with
+// g_msg_cached for each match
+pub const g_msg_get: u16 = 6;
+// to a peer, after the g_msg_cached of a new peer or a g_msg_get, count
+// of g_msg_cached sent
+pub const g_msg_cached_end: u16 = 7;
+
+// requests from peers go ahead of periodic reads and should be on the
+// bus right away
+const g_request_priority: u8 = 255;
+
+pub const tty_adapt_info_t = struct // adaptive interval for a block
+{
+    min_interval_mstime: i64 = 1000,
+    max_interval_mstime: i64 = 60000,
+    watch_offset: u16 = 0, // register in the block that is watched
+    watch_scale: f64 = 1.0, // register value is divided by this
+    watch_threshold: ?f64 = null, // fastest polling near this value
+    watch_band: f64 = 0.0, // how near is near
+    rate_threshold: f64 = 0.0, // change per second that counts as moving
+};
+
+pub const tty_deadband_info_t = struct // change only publishing of a block
+{
+    // for each register, raw units and percent of the value last
+    // published, a register moved when it is past both, 0 and 0 is any
+    // change
+    absolute: []f32 = &.{},
+    percent: []f32 = &.{},
+    keyframe_cycles: u32 = 10, // reads, published anyway, 0 is never
+    // bus thread
+    last: []u16 = &.{}, // last published
+    have_last: bool = false, // false publishes the next read
+    cycles: u32 = 0, // reads since last published
+
+    //*************************************************************************
+    pub fn deinit(self: *tty_deadband_info_t) void
+    {
+        g_allocator.free(self.absolute);
+        g_allocator.free(self.percent);
+        g_allocator.free(self.last);
+    }
+
+    //*************************************************************************
+    // true if regs should be published, remembers them if so
+    pub fn moved(self: *tty_deadband_info_t, regs: []const u16) bool
+    {
+        self.cycles += 1;
+        var publish = !self.have_last or ((self.keyframe_cycles > 0) and
+                (self.cycles >= self.keyframe_cycles));
+        if (!publish)
+        {
+            for (regs, 0..) |areg, index|
+            {
+                const last: f32 = @floatFromInt(self.last[index]);
+                const diff = @abs(@as(f32, @floatFromInt(areg)) - last);
+                if ((diff > self.absolute[index]) and
+                        (diff > self.percent[index] * last / 100.0))
+                {
+                    publish = true;
+                    break;
+                }
+            }
+        }
+        if (publish)
+        {
+            std.mem.copyForwards(u16, self.last, regs);
+            self.have_last = true;
+            self.cycles = 0;
+        }
+        return publish;
+    }
+};
+
+pub const tty_block_info_t = struct // one for each register block of a device
+{
+    reg_type: u8 = g_reg_type_holding,
+    address: u16 = 0,
+    count: u16 = 0,
+    interval_mstime: ?i64 = null, // overrides tty_id_info_t.interval_mstime
+    priority: ?u8 = null, // overrides tty_id_info_t.priority
+    align_to_clock: ?bool = null, // overrides tty_id_info_t.align_to_clock
+    deadline_mstime: ?i64 = null, // overrides tty_id_info_t.deadline_mstime
+    static: bool = false, // read once, cached and sent to new peers
+    adapt: ?tty_adapt_info_t = null, // adaptive blocks are never merged
+    deadband: ?tty_deadband_info_t = null, // null publishes every read
 };
 
 pub const tty_id_info_t = struct // one for each modbus device we are monitoring
 {
     id: u8 = 0,
-    read_address: u16 = 0,
-    read_count: u8 = 0,
-    read_input_address: u16 = 0,
-    read_input_count: u8 = 0,
+    merge_gap: ?u16 = null, // overrides bus merge_gap
+    interval_mstime: ?i64 = null, // overrides bus list_mstime
+    priority: ?u8 = null, // higher is read first when reads are due together
+    align_to_clock: ?bool = null, // overrides bus align_to_clock
+    deadline_mstime: ?i64 = null, // after due, null is the interval
+    write_read: bool = false, // takes 0x17, else it is split in two
+    // --provision, holding register taking an index into baud_rates
+    baud_register: ?u16 = null,
+    baud_rates: [8]u32 = .{0} ** 8,
+    baud_rates_count: u8 = 0,
+    blocks: std.ArrayListUnmanaged(tty_block_info_t) = .{},
+    latency: slave.latency_t = .{}, // measured, adaptive_response
+    health: slave.health_t = .{},
+
+    //*************************************************************************
+    pub fn deinit(self: *tty_id_info_t) void
+    {
+        for (self.blocks.items) |*ablock|
+        {
+            if (ablock.deadband) |*adeadband|
+            {
+                adeadband.deinit();
+            }
+        }
+        self.blocks.deinit(g_allocator);
+    }
+};
+
+pub const tty_read_info_t = struct // one for each planned modbus read
+{
+    id: u8 = 0,
+    reg_type: u8 = g_reg_type_holding,
+    address: u16 = 0,
+    count: u16 = 0,
+    id_index: usize = 0, // index into id_list
+    block_index: usize = 0, // first block in id_info.blocks
+    block_count: usize = 0, // blocks covered by this read
+    interval_mstime: i64 = 0,
+    priority: u8 = 0,
+    align_to_clock: bool = false,
+    deadline_mstime: ?i64 = null, // null is interval_mstime
+    static: bool = false, // only static blocks, not polled once read
+    static_valid: bool = false, // static and read since the slave came up
+    next_mstime: i64 = 0, // when this read is due
+    in_flight: bool = false, // on the bus, not in the schedule
+    missed: u64 = 0, // slots skipped because the bus was late
+    deadline_misses: u64 = 0, // started after its deadline
+    retried: bool = false, // a garbled response gets one quick retry
+    jitter: sched.hist_t = .{}, // actual - scheduled start
+    adapt: ?tty_adapt_info_t = null,
+    last_value: ?f64 = null, // watched register, adaptive reads
+    last_value_mstime: i64 = 0,
+};
+
+// a 0x17 job to a slave without write_read goes as a 0x10 write then a
+// 0x03 read, answered as if it was a 0x17
+pub const tty_job_step_t = enum
+{
+    Whole, // pdu as is
+    Write, // the write half of a 0x17
+    Read, // the read half of a 0x17
+};
+
+pub const tty_job_t = struct // one shot transaction, a write or on demand read
+{
+    id: u8 = 0,
+    pdu: [253]u8 = undefined, // function code and data
+    pdu_len: usize = 0,
+    priority: u8 = 0,
+    deadline: i64 = 0, // milliTimestamp it should be on the bus by
+    peer_id: u32 = 0, // peer that asked, 0 for none
+    tag: u32 = 0, // peer's id for the request, in the response
+    step: tty_job_step_t = .Whole,
+    next: ?*tty_job_t = null, // bus submit queue
 };
 
 pub const tty_info_t = struct // just one of these
 {
     sck: i32 = -1, // listener
-    modbus_debug: bool = false,
-    item_mstime: i64 = 0,
-    list_mstime: i64 = 0,
-    tty: [g_tty_name_max_length:0]u8 = .{0} ** g_tty_name_max_length,
     listen_socket: [g_tty_name_max_length:0]u8 = .{0} ** g_tty_name_max_length,
-    id_list: std.ArrayListUnmanaged(tty_id_info_t) = undefined,
-    peer_list: std.ArrayListUnmanaged(tty_peer_info_t) = undefined,
-    ctx: *c.modbus_t = undefined,
-    id_list_index: usize = 0,
-    id_list_sub_index: usize = 0,
-    response_sec: u32 = 0,
-    response_usec: u32 = 0,
-    min_mstime: u32 = 0,
-    last_modbus_time: ?i64 = null,
-    next_modbus_time: ?i64 = null,
-    first_modbus_time: ?i64 = null,
+    defaults: tty_bus.tty_bus_config_t = .{}, // from [main]
+    mlockall: bool = false, // lock all memory, no page faults on the buses
+    bus_list: std.ArrayListUnmanaged(*tty_bus.tty_bus_info_t) = .{},
+    peer_list: std.ArrayListUnmanaged(*tty_peer_info_t) = .{},
+    peer_map: std.AutoHashMapUnmanaged(i32, *tty_peer_info_t) = .{}, // sck
+    epfd: i32 = -1, // while tty_main_loop runs
+    // --io-uring, peers that got a backlog this pass, sent together
+    uring: ?uring.uring_t = null,
+    dirty: std.ArrayListUnmanaged(*tty_peer_info_t) = .{},
+    peer_count: std.atomic.Value(usize) = std.atomic.Value(usize).init(0),
+    // ids some peer wants g_msg_status for, bus threads do not encode
+    // status for the rest, blocks always go to the cache
+    status_ids: [8]std.atomic.Value(u32) =
+            .{std.atomic.Value(u32).init(0)} ** 8,
+    next_peer_id: u32 = 1,
+    // last g_msg_regs of each block, by type, id and address, sent to
+    // new peers and on g_msg_get
+    cache: std.AutoArrayHashMapUnmanaged(u64, *tty_msg_t) = .{},
+    // bus threads queue messages here and write a byte to notify
+    msg_mutex: std.Thread.Mutex = .{},
+    msg_head: ?*tty_msg_t = null,
+    msg_tail: ?*tty_msg_t = null,
+    // free messages, also under msg_mutex
+    msg_pool: ?*tty_msg_t = null,
+    msg_pool_count: usize = 0,
+    notify: [2]i32 = .{-1, -1},
 
     //*************************************************************************
     fn init(self: *tty_info_t) !void
     {
         self.* = .{};
-        self.id_list = try std.ArrayListUnmanaged(tty_id_info_t).
-                initCapacity(g_allocator, 32);
-        self.peer_list = try std.ArrayListUnmanaged(tty_peer_info_t).
-                initCapacity(g_allocator, 32);
+        self.notify = try posix.pipe2(.{.NONBLOCK = true});
     }
 
     //*************************************************************************
     fn deinit(self: *tty_info_t) void
     {
-        self.id_list.deinit(g_allocator);
-        for (self.peer_list.items) |*aitem|
+        deinit_bus_list(&self.bus_list);
+        free_msgs(self.msg_head);
+        for (self.cache.values()) |amsg|
+        {
+            self.release_msg(amsg);
+        }
+        self.cache.deinit(g_allocator);
+        for (self.peer_list.items) |aitem|
         {
-            aitem.deinit();
+            aitem.deinit(self);
+            g_allocator.destroy(aitem);
         }
         self.peer_list.deinit(g_allocator);
+        self.peer_map.deinit(g_allocator);
+        self.dirty.deinit(g_allocator);
+        if (self.uring) |*auring|
+        {
+            auring.deinit();
+        }
+        free_msgs(self.msg_pool);
+        posix.close(self.notify[0]);
+        posix.close(self.notify[1]);
     }
 
     //*************************************************************************
-    fn get_next_id_info(self: *tty_info_t) ?*tty_id_info_t
+    // an empty message from the pool, any thread
+    fn get_msg(self: *tty_info_t) !*tty_msg_t
     {
-        if (self.id_list_sub_index > 1)
+        self.msg_mutex.lock();
+        const pooled = self.msg_pool;
+        if (pooled) |amsg|
+        {
+            self.msg_pool = amsg.next;
+            self.msg_pool_count -= 1;
+        }
+        self.msg_mutex.unlock();
+        var msg: *tty_msg_t = undefined;
+        if (pooled) |amsg|
+        {
+            msg = amsg;
+        }
+        else
         {
-            self.id_list_index += 1;
-            self.id_list_sub_index = 0;
+            msg = try g_allocator.create(tty_msg_t);
+            errdefer g_allocator.destroy(msg);
+            msg.* = .{.s = try parse.parse_t.create(&g_allocator,
+                    g_msg_max)};
         }
-        if (self.id_list_index >= self.id_list.items.len)
+        try msg.s.reset(0);
+        msg.* = .{.s = msg.s, .refs = 1}; // the caller's
+        return msg;
+    }
+
+    //*************************************************************************
+    // drop a reference, the main thread or a bus thread before it queues
+    // msg, the last one pools the message
+    fn release_msg(self: *tty_info_t, msg: *tty_msg_t) void
+    {
+        msg.refs -= 1;
+        if (msg.refs > 0)
+        {
+            return;
+        }
+        self.msg_mutex.lock();
+        if (self.msg_pool_count < g_msg_pool_max)
+        {
+            msg.next = self.msg_pool;
+            self.msg_pool = msg;
+            self.msg_pool_count += 1;
+            self.msg_mutex.unlock();
+            return;
+        }
+        self.msg_mutex.unlock();
+        msg.next = null;
+        free_msgs(msg);
+    }
+
+    //*************************************************************************
+    // any thread
+    fn wants_status(self: *tty_info_t, id: u8) bool
+    {
+        const mask = self.status_ids[id / 32].load(.acquire);
+        return ((mask >> @intCast(id % 32)) & 1) != 0;
+    }
+
+    //*************************************************************************
+    pub fn get_bus(self: *tty_info_t, bus: u8) ?*tty_bus.tty_bus_info_t
+    {
+        for (self.bus_list.items) |abus|
         {
-            self.id_list_index = 0;
-            self.id_list_sub_index = 0;
-            return null;
+            if (abus.bus == bus)
+            {
+                return abus;
+            }
         }
-        const item = &self.id_list.items[self.id_list_index];
-        if ((self.id_list_sub_index == 0) and (item.read_count > 0))
+        return null;
+    }
+
+    //*************************************************************************
+    // bus with id on it, the first bus for ids not in the config
+    pub fn get_bus_for_id(self: *tty_info_t, id: u8) ?*tty_bus.tty_bus_info_t
+    {
+        for (self.bus_list.items) |abus|
         {
-            self.id_list_sub_index += 1;
-            return item;
+            for (abus.id_list.items) |*item|
+            {
+                if (item.id == id)
+                {
+                    return abus;
+                }
+            }
         }
-        if ((self.id_list_sub_index == 1) and (item.read_input_count > 0))
+        if (self.bus_list.items.len > 0)
         {
-            self.id_list_sub_index += 1;
-            return item;
+            return self.bus_list.items[0];
         }
-        self.id_list_sub_index += 1;
-        return get_next_id_info(self);
+        return null;
     }
 };
 
+//*****************************************************************************
+fn deinit_bus_list(bus_list: *std.ArrayListUnmanaged(*tty_bus.tty_bus_info_t))
+        void
+{
+    for (bus_list.items) |abus|
+    {
+        abus.delete();
+    }
+    bus_list.deinit(g_allocator);
+}
+
+//*****************************************************************************
+fn free_msgs(msg_head: ?*tty_msg_t) void
+{
+    var msg = msg_head;
+    while (msg) |amsg|
+    {
+        msg = amsg.next;
+        amsg.s.delete();
+        g_allocator.destroy(amsg);
+    }
+}
+
 //*****************************************************************************
 fn tty_sleep(mstime: i32) !void
 {
@@ -189,6 +610,13 @@ export fn hup_sig(_: c_int) void
     _ = posix.write(g_hup[1], msg[0..4]) catch return;
 }
 
+//*****************************************************************************
+export fn usr1_sig(_: c_int) void
+{
+    const msg: [4]u8 = .{'u', 's', 'r', 0};
+    _ = posix.write(g_usr1[1], msg[0..4]) catch return;
+}
+
 //*****************************************************************************
 export fn pipe_sig(_: c_int) void
 {
@@ -199,6 +627,7 @@ fn setup_signals() !void
 {
     g_term = try posix.pipe();
     g_hup = try posix.pipe();
+    g_usr1 = try posix.pipe();
     var sa: posix.Sigaction = undefined;
     sa.mask =
     if ((builtin.zig_version.major == 0) and (builtin.zig_version.minor < 15))
@@ -211,321 +640,869 @@ fn setup_signals() !void
         try posix.sigaction(posix.SIG.TERM, &sa, null);
         sa.handler = .{.handler = hup_sig};
         try posix.sigaction(posix.SIG.HUP, &sa, null);
+        sa.handler = .{.handler = usr1_sig};
+        try posix.sigaction(posix.SIG.USR1, &sa, null);
         sa.handler = .{.handler = pipe_sig};
         try posix.sigaction(posix.SIG.PIPE, &sa, null);
     }
-    else
+    else
+    {
+        posix.sigaction(posix.SIG.INT, &sa, null);
+        posix.sigaction(posix.SIG.TERM, &sa, null);
+        sa.handler = .{.handler = hup_sig};
+        posix.sigaction(posix.SIG.HUP, &sa, null);
+        sa.handler = .{.handler = usr1_sig};
+        posix.sigaction(posix.SIG.USR1, &sa, null);
+        sa.handler = .{.handler = pipe_sig};
+        posix.sigaction(posix.SIG.PIPE, &sa, null);
+    }
+}
+
+//*****************************************************************************
+fn cleanup_signals() void
+{
+    posix.close(g_term[0]);
+    posix.close(g_term[1]);
+    posix.close(g_hup[0]);
+    posix.close(g_hup[1]);
+    posix.close(g_usr1[0]);
+    posix.close(g_usr1[1]);
+}
+
+//*****************************************************************************
+fn print_tty_info(info: *tty_info_t) !void
+{
+    try log.logln(log.LogLevel.info, @src(),
+            "tty info: listen_socket [{s}] mlockall [{}] got [{}] bus",
+            .{std.mem.sliceTo(&info.listen_socket, 0), info.mlockall,
+            info.bus_list.items.len});
+    for (info.bus_list.items) |abus|
+    {
+        try tty_bus.print_bus_info(abus);
+    }
+}
+
+//*****************************************************************************
+// called from the bus threads, encode once and queue for the main thread
+// every block goes to the cache, even if no peer wants it now
+pub fn publish_block(info: *tty_info_t, id: u8, reg_type: u8, address: u16,
+        regs: []u16) !void
+{
+    const msg_size = 2 + 2 + 2 + 2 + 2 + 2 + regs.len * 2;
+    const msg = try info.get_msg();
+    errdefer info.release_msg(msg);
+    msg.* = .{.s = msg.s, .refs = msg.refs,
+            .mstime = std.time.milliTimestamp(), .code = g_msg_regs,
+            .id = id, .reg_type = reg_type, .address = address,
+            .count = @intCast(regs.len)};
+    const s = msg.s;
+    try s.check_rem(msg_size);
+    s.out_u16_le(g_msg_regs); // msg id
+    s.out_u16_le(@intCast(msg_size)); // size
+    s.out_u16_le(reg_type); // type
+    s.out_u16_le(id);
+    s.out_u16_le(address);
+    s.out_u16_le(@intCast(regs.len));
+    for (regs) |areg|
+    {
+        s.out_u16_le(areg);
+    }
+    queue_msg(info, msg);
+}
+
+//*****************************************************************************
+// called from the bus threads, state is slave.health_state_t, reason is
+// 0 for ok or a tty_bus.g_reason_ value
+pub fn publish_status(info: *tty_info_t, bus: u8, id: u8, reg_type: u8,
+        address: u16, count: u16, state: u16, reason: u16) !void
+{
+    if (!info.wants_status(id))
+    {
+        return;
+    }
+    const msg_size = 2 + 2 + 2 + 2 + 2 + 2 + 2 + 2 + 2;
+    const msg = try info.get_msg();
+    errdefer info.release_msg(msg);
+    msg.* = .{.s = msg.s, .refs = msg.refs, .code = g_msg_status, .id = id,
+            .reg_type = reg_type, .address = address, .count = count};
+    const s = msg.s;
+    try s.check_rem(msg_size);
+    s.out_u16_le(g_msg_status); // msg id
+    s.out_u16_le(msg_size); // size
+    s.out_u16_le(bus);
+    s.out_u16_le(id);
+    s.out_u16_le(reg_type);
+    s.out_u16_le(address);
+    s.out_u16_le(count);
+    s.out_u16_le(state);
+    s.out_u16_le(reason);
+    queue_msg(info, msg);
+}
+
+//*****************************************************************************
+// answer to a g_msg_request, reason is 0 for ok or a tty_bus.g_reason_
+// value, pdu is the response pdu, function | 0x80 and the exception code
+// for g_reason_exception, empty for other reasons
+fn publish_response(info: *tty_info_t, peer_id: u32, tag: u32, id: u8,
+        reason: u16, pdu: []const u8) !void
+{
+    const msg_size = 2 + 2 + 4 + 2 + 2 + 2 + pdu.len;
+    const msg = try info.get_msg();
+    errdefer info.release_msg(msg);
+    const s = msg.s;
+    try s.check_rem(msg_size);
+    msg.code = g_msg_response;
+    s.out_u16_le(g_msg_response); // msg id
+    s.out_u16_le(@intCast(msg_size)); // size
+    s.out_u32_le(tag);
+    s.out_u16_le(id);
+    s.out_u16_le(reason);
+    s.out_u16_le(@intCast(pdu.len));
+    for (pdu) |abyte|
+    {
+        s.out_u8(abyte);
+    }
+    queue_msg_to(info, msg, peer_id);
+}
+
+//*****************************************************************************
+fn queue_msg(info: *tty_info_t, msg: *tty_msg_t) void
+{
+    queue_msg_to(info, msg, 0);
+}
+
+//*****************************************************************************
+// msg encoded in msg.s, its reference goes to the main thread, peer_id 0
+// is every peer
+fn queue_msg_to(info: *tty_info_t, msg: *tty_msg_t, peer_id: u32) void
+{
+    msg.data = msg.s.get_out_slice();
+    msg.peer_id = peer_id;
+    info.msg_mutex.lock();
+    defer info.msg_mutex.unlock();
+    if (info.msg_tail) |amsg_tail|
+    {
+        amsg_tail.next = msg;
+        info.msg_tail = msg;
+    }
+    else
+    {
+        info.msg_head = msg;
+        info.msg_tail = msg;
+    }
+    // if the pipe is full the main thread is already going to wake up
+    const notify_msg: [1]u8 = .{'m'};
+    _ = posix.write(info.notify[1], notify_msg[0..1]) catch 0;
+}
+
+//*****************************************************************************
+// take everything the bus threads queued and add it to each peer
+fn check_msgs(info: *tty_info_t) !void
+{
+    var notify_buf: [64]u8 = undefined;
+    _ = posix.read(info.notify[0], &notify_buf) catch 0;
+    info.msg_mutex.lock();
+    const msg_head = info.msg_head;
+    info.msg_head = null;
+    info.msg_tail = null;
+    info.msg_mutex.unlock();
+    try log.logln_devel(log.LogLevel.info, @src(), "peer len {}",
+            .{info.peer_list.items.len});
+    var msg = msg_head;
+    errdefer
+    {
+        // the ones not reached yet go back to the pool
+        while (msg) |amsg|
+        {
+            msg = amsg.next;
+            info.release_msg(amsg);
+        }
+    }
+    while (msg) |amsg|
+    {
+        msg = amsg.next;
+        // the bus thread's reference is dropped once every peer has one
+        defer info.release_msg(amsg);
+        if (amsg.code == g_msg_regs)
+        {
+            try update_cache(info, amsg);
+        }
+        for (info.peer_list.items) |aitem|
+        {
+            if ((amsg.peer_id != 0) and (amsg.peer_id != aitem.peer_id))
+            {
+                continue;
+            }
+            if (!aitem.filter.wants(amsg))
+            {
+                continue;
+            }
+            try add_send(info, aitem, amsg);
+        }
+    }
+}
+
+//*****************************************************************************
+// queue a reference to msg, the list keeps its capacity so this only
+// allocates while a peer's backlog grows
+fn add_send(info: *tty_info_t, peer: *tty_peer_info_t, msg: *tty_msg_t) !void
+{
+    try peer.sends.append(g_allocator, msg);
+    msg.refs += 1;
+    try arm_peer(info, peer);
+}
+
+//*****************************************************************************
+// EPOLL.OUT only while the peer has something to send, with io_uring a
+// new backlog is sent at the end of the pass and EPOLL.OUT is only for
+// what the socket did not take
+fn arm_peer(info: *tty_info_t, peer: *tty_peer_info_t) !void
+{
+    const want_out = peer.has_sends();
+    if ((info.epfd == -1) or (want_out == peer.out_armed))
+    {
+        return;
+    }
+    if (want_out and (info.uring != null))
+    {
+        if (!peer.dirty)
+        {
+            try info.dirty.append(g_allocator, peer);
+            peer.dirty = true;
+        }
+        return;
+    }
+    try set_out(info, peer, want_out);
+}
+
+//*****************************************************************************
+fn set_out(info: *tty_info_t, peer: *tty_peer_info_t, want_out: bool) !void
+{
+    var event = peer_event(peer, want_out);
+    try posix.epoll_ctl(info.epfd, linux.EPOLL.CTL_MOD, peer.sck, &event);
+    peer.out_armed = want_out;
+}
+
+//*****************************************************************************
+fn peer_event(peer: *tty_peer_info_t, out: bool) linux.epoll_event
+{
+    var events: u32 = linux.EPOLL.IN;
+    if (out)
+    {
+        events |= linux.EPOLL.OUT;
+    }
+    return .{.events = events, .data = .{.fd = peer.sck}};
+}
+
+//*****************************************************************************
+// msg is all sent, drop it from the front of the peer's sends
+fn pop_send(info: *tty_info_t, peer: *tty_peer_info_t) void
+{
+    info.release_msg(peer.sends.items[peer.send_index]);
+    peer.send_index += 1;
+    peer.sent = 0;
+    const items = peer.sends.items;
+    if (peer.send_index >= items.len)
+    {
+        peer.sends.clearRetainingCapacity();
+        peer.send_index = 0;
+    }
+    else if (peer.send_index * 2 > items.len)
+    {
+        // more sent than waiting, move the rest down
+        std.mem.copyForwards(*tty_msg_t, items,
+                items[peer.send_index..]);
+        peer.sends.shrinkRetainingCapacity(items.len - peer.send_index);
+        peer.send_index = 0;
+    }
+}
+
+//*****************************************************************************
+// peer.msghdr for up to g_max_iov messages of the backlog, from
+// peer.sent into the first one
+fn fill_send(peer: *tty_peer_info_t) void
+{
+    const msgs = peer.sends.items[peer.send_index..];
+    const count = @min(msgs.len, peer.iovs.len);
+    for (msgs[0..count], peer.iovs[0..count], 0..) |amsg, *aiov, index|
+    {
+        uring.set_iov(aiov, if (index == 0) amsg.data[peer.sent..] else
+                amsg.data);
+    }
+    peer.msghdr = .{.name = null, .namelen = 0, .iov = &peer.iovs,
+            .iovlen = @intCast(count), .control = null, .controllen = 0,
+            .flags = 0};
+}
+
+//*****************************************************************************
+// as much of the peer's backlog as the socket takes in one sendmsg,
+// returns bytes sent, 0 when the socket is full, the peer gets POLL.OUT
+// again
+fn send_peer(info: *tty_info_t, peer: *tty_peer_info_t) !usize
+{
+    fill_send(peer);
+    const sent = posix.sendmsg(peer.sck, &peer.msghdr,
+            posix.MSG.DONTWAIT | posix.MSG.NOSIGNAL) catch |err|
+    {
+        if (err == error.WouldBlock)
+        {
+            return 0;
+        }
+        return err;
+    };
+    sent_peer(info, peer, sent);
+    return sent;
+}
+
+//*****************************************************************************
+// drop what is all sent, remember how far into the next one
+fn sent_peer(info: *tty_info_t, peer: *tty_peer_info_t, sent: usize) void
+{
+    var left = sent;
+    while (left > 0)
+    {
+        const msg = peer.sends.items[peer.send_index];
+        const rem = msg.data.len - peer.sent;
+        if (left < rem)
+        {
+            peer.sent += left;
+            break;
+        }
+        left -= rem;
+        pop_send(info, peer);
+    }
+}
+
+//*****************************************************************************
+// io_uring, one sendmsg for each peer that got a backlog this pass, all
+// in one submit, what a socket does not take waits for EPOLL.OUT
+fn flush_peers(info: *tty_info_t, auring: *uring.uring_t) !void
+{
+    // remove_peer below must not change the list being walked
+    var dirty = info.dirty;
+    info.dirty = .{};
+    defer
+    {
+        dirty.clearRetainingCapacity();
+        info.dirty.deinit(g_allocator);
+        info.dirty = dirty;
+    }
+    var cqes: [uring.g_entries]linux.io_uring_cqe = undefined;
+    var start: usize = 0;
+    while (start < dirty.items.len)
+    {
+        const chunk = dirty.items[start..][0..@min(uring.g_entries,
+                dirty.items.len - start)];
+        start += chunk.len;
+        for (chunk, 0..) |apeer, index|
+        {
+            apeer.dirty = false;
+            fill_send(apeer);
+            try auring.queue_sendmsg(index, apeer.sck, &apeer.msghdr);
+        }
+        for (try auring.submit_all(&cqes)) |acqe|
+        {
+            const peer = chunk[@intCast(acqe.user_data)];
+            if (acqe.res >= 0)
+            {
+                sent_peer(info, peer, @intCast(acqe.res));
+            }
+            else if (acqe.err() != .AGAIN)
+            {
+                try log.logln(log.LogLevel.info, @src(),
+                        "removing sck {} {}", .{peer.sck, acqe.err()});
+                remove_peer(info, peer);
+                continue;
+            }
+            if (peer.has_sends())
+            {
+                set_out(info, peer, true) catch |err|
+                {
+                    try log.logln(log.LogLevel.info, @src(),
+                            "removing sck {} {}", .{peer.sck, err});
+                    remove_peer(info, peer);
+                };
+            }
+        }
+    }
+}
+
+//*****************************************************************************
+// keep the newest g_msg_regs of each block, type, id and address tell
+// the blocks apart
+fn update_cache(info: *tty_info_t, msg: *tty_msg_t) !void
+{
+    const key = cache_key(msg.reg_type, msg.id, msg.address);
+    const entry = try info.cache.getOrPut(g_allocator, key);
+    if (entry.found_existing)
+    {
+        info.release_msg(entry.value_ptr.*);
+    }
+    entry.value_ptr.* = msg;
+    msg.refs += 1;
+}
+
+//*****************************************************************************
+fn cache_key(reg_type: u16, id: u8, address: u16) u64
+{
+    return (@as(u64, reg_type) << 32) | (@as(u64, id) << 16) | address;
+}
+
+//*****************************************************************************
+// after a reload, drop what is cached for blocks no longer configured
+fn prune_cache(info: *tty_info_t) void
+{
+    var index: usize = 0;
+    while (index < info.cache.count())
+    {
+        if (is_configured(info, info.cache.keys()[index]))
+        {
+            index += 1;
+            continue;
+        }
+        info.release_msg(info.cache.values()[index]);
+        info.cache.swapRemoveAt(index);
+    }
+}
+
+//*****************************************************************************
+// true if key is the cache_key of a block in the config
+fn is_configured(info: *tty_info_t, key: u64) bool
+{
+    for (info.bus_list.items) |abus|
+    {
+        for (abus.id_list.items) |*aitem|
+        {
+            for (aitem.blocks.items) |*ablock|
+            {
+                if (cache_key(ablock.reg_type, aitem.id,
+                        ablock.address) == key)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+//*****************************************************************************
+// the cached blocks filter lets through as g_msg_cached with their age,
+// then g_msg_cached_end, null filter is everything, returns the count
+fn send_cached(info: *tty_info_t, peer: *tty_peer_info_t,
+        filter: ?*tty_filter_t) !u32
+{
+    const now = std.time.milliTimestamp();
+    var sent: u32 = 0;
+    for (info.cache.values()) |amsg|
+    {
+        if (filter) |afilter|
+        {
+            if (!afilter.wants(amsg))
+            {
+                continue;
+            }
+        }
+        // same as the g_msg_regs with the age ahead of the body
+        const body = amsg.data[4..];
+        const msg_size = 2 + 2 + 4 + body.len;
+        const msg = try info.get_msg();
+        defer info.release_msg(msg);
+        const s = msg.s;
+        try s.check_rem(msg_size);
+        s.out_u16_le(g_msg_cached); // msg id
+        s.out_u16_le(@intCast(msg_size)); // size
+        s.out_u32_le(@intCast(std.math.clamp(now - amsg.mstime, 0,
+                std.math.maxInt(u32))));
+        for (body) |abyte|
+        {
+            s.out_u8(abyte);
+        }
+        msg.data = s.get_out_slice();
+        try add_send(info, peer, msg);
+        sent += 1;
+    }
+    const msg_size = 2 + 2 + 4;
+    const msg = try info.get_msg();
+    defer info.release_msg(msg);
+    const s = msg.s;
+    try s.check_rem(msg_size);
+    s.out_u16_le(g_msg_cached_end); // msg id
+    s.out_u16_le(msg_size); // size
+    s.out_u32_le(sent);
+    msg.data = s.get_out_slice();
+    try add_send(info, peer, msg);
+    return sent;
+}
+
+//*****************************************************************************
+pub fn create_job(id: u8, pdu: []const u8, priority: u8,
+        deadline_mstime: i64) !*tty_job_t
+{
+    if ((pdu.len < 1) or (pdu.len > 253))
+    {
+        return error.InvalidParam;
+    }
+    const job = try g_allocator.create(tty_job_t);
+    job.* = .{.id = id, .pdu_len = pdu.len, .priority = priority,
+            .deadline = std.time.milliTimestamp() + deadline_mstime};
+    std.mem.copyForwards(u8, &job.pdu, pdu);
+    return job;
+}
+
+//*****************************************************************************
+// called from a bus thread when a job is off the bus, pdu is the
+// response, the job is freed here
+pub fn job_done(info: *tty_info_t, job: *tty_job_t, err: ?anyerror,
+        pdu: []const u8) void
+{
+    defer g_allocator.destroy(job);
+    var reason: u16 = 0;
+    var rsp_pdu = pdu;
+    if (err) |aerr|
+    {
+        log.logln(log.LogLevel.info, @src(),
+                "job id {} function {} failed {}",
+                .{job.id, job.pdu[0], aerr}) catch return;
+        reason = tty_bus.status_reason(aerr);
+        if (reason != tty_bus.g_reason_exception)
+        {
+            rsp_pdu = &.{};
+        }
+    }
+    else
+    {
+        log.logln_devel(log.LogLevel.info, @src(),
+                "job id {} function {} response {} bytes",
+                .{job.id, job.pdu[0], pdu.len}) catch return;
+    }
+    if (job.peer_id != 0)
+    {
+        publish_response(info, job.peer_id, job.tag, job.id, reason,
+                rsp_pdu) catch |aerr|
+        {
+            log.logln(log.LogLevel.info, @src(),
+                    "publish_response failed {}", .{aerr}) catch return;
+        };
+    }
+}
+
+//*****************************************************************************
+// g_msg_request, tag, id, pdu length, pdu, queued on the bus the slave
+// is on, the answer comes back from job_done
+fn process_request(info: *tty_info_t, peer: *tty_peer_info_t,
+        s: *parse.parse_t) !void
+{
+    try s.check_rem(4 + 2 + 2);
+    const tag = s.in_u32_le();
+    const id: u8 = @truncate(s.in_u16_le());
+    const pdu_len = s.in_u16_le();
+    var pdu: [253]u8 = undefined;
+    if ((pdu_len < 1) or (pdu_len > pdu.len))
+    {
+        return TtyError.BadMsg;
+    }
+    try s.check_rem(pdu_len);
+    for (pdu[0..pdu_len]) |*abyte|
+    {
+        abyte.* = s.in_u8();
+    }
+    try log.logln_devel(log.LogLevel.info, @src(),
+            "peer sck {} tag {} id {} function {}",
+            .{peer.sck, tag, id, pdu[0]});
+    const bus = info.get_bus_for_id(id) orelse
+    {
+        return publish_response(info, peer.peer_id, tag, id,
+                tty_bus.g_reason_other, &.{});
+    };
+    const job = try create_job(id, pdu[0..pdu_len], g_request_priority,
+            bus.config.request_deadline_mstime);
+    job.peer_id = peer.peer_id;
+    job.tag = tag;
+    bus.submit_job(job);
+}
+
+//*****************************************************************************
+// g_msg_subscribe, the peer only gets what matches from now on
+fn process_subscribe(info: *tty_info_t, peer: *tty_peer_info_t,
+        s: *parse.parse_t) !void
+{
+    try s.check_rem(2);
+    const codes = s.in_u16_le();
+    const filter = &peer.filter;
+    filter.subscribed = true;
+    filter.codes = codes;
+    const range_count = try read_ranges(filter, s);
+    try log.logln(log.LogLevel.info, @src(),
+            "peer sck {} subscribed codes 0x{X} ranges {}",
+            .{peer.sck, codes, range_count});
+    update_status_ids(info);
+}
+
+//*****************************************************************************
+// g_msg_get, the cached blocks that match, now
+fn process_get(info: *tty_info_t, peer: *tty_peer_info_t,
+        s: *parse.parse_t) !void
+{
+    var filter: tty_filter_t = .{.subscribed = true,
+            .codes = 1 << g_msg_regs};
+    defer filter.deinit();
+    _ = try read_ranges(&filter, s);
+    _ = try send_cached(info, peer, &filter);
+}
+
+//*****************************************************************************
+// range count and the ranges of a g_msg_subscribe or g_msg_get, replaces
+// the ranges in filter, returns the count
+fn read_ranges(filter: *tty_filter_t, s: *parse.parse_t) !u16
+{
+    try s.check_rem(2);
+    const range_count = s.in_u16_le();
+    try s.check_rem(@as(usize, range_count) * 8);
+    filter.ids = tty_id_set_t.initEmpty();
+    filter.ranges.clearRetainingCapacity();
+    for (0..range_count) |_|
+    {
+        const id = s.in_u16_le();
+        const reg_type = s.in_u16_le();
+        const address = s.in_u16_le();
+        const count = s.in_u16_le();
+        if (id > 255)
+        {
+            return TtyError.BadMsg;
+        }
+        try filter.ranges.append(g_allocator, .{.id = @intCast(id),
+                .reg_type = reg_type, .address = address, .count = count});
+        filter.ids.set(id);
+    }
+    return range_count;
+}
+
+//*****************************************************************************
+// the union of the peer filters for g_msg_status, no peers is no ids
+fn update_status_ids(info: *tty_info_t) void
+{
+    var ids = tty_id_set_t.initEmpty();
+    for (info.peer_list.items) |aitem|
+    {
+        ids.setUnion(aitem.filter.want_ids(g_msg_status));
+    }
+    for (&info.status_ids, ids.masks) |*awant, amask|
     {
-        posix.sigaction(posix.SIG.INT, &sa, null);
-        posix.sigaction(posix.SIG.TERM, &sa, null);
-        sa.handler = .{.handler = hup_sig};
-        posix.sigaction(posix.SIG.HUP, &sa, null);
-        sa.handler = .{.handler = pipe_sig};
-        posix.sigaction(posix.SIG.PIPE, &sa, null);
+        awant.store(amask, .release);
     }
 }
 
 //*****************************************************************************
-fn cleanup_signals() void
+// read what the peer sent, a message is a 4 byte code and size header
+// then size - 4 more bytes
+fn process_peer_in(info: *tty_info_t, peer: *tty_peer_info_t) !void
 {
-    posix.close(g_term[0]);
-    posix.close(g_term[1]);
-    posix.close(g_hup[0]);
-    posix.close(g_hup[1]);
+    const ins = peer.ins;
+    const read = posix.recv(peer.sck,
+            ins.data[peer.readed..peer.to_read], 0) catch 0;
+    if (read < 1)
+    {
+        return TtyError.BadMsg;
+    }
+    peer.readed += read;
+    if (peer.readed < peer.to_read)
+    {
+        return;
+    }
+    if (peer.to_read == 4)
+    {
+        try ins.reset(0);
+        try ins.check_rem(4);
+        peer.code = ins.in_u16_le();
+        peer.size = ins.in_u16_le();
+        if (peer.size < 4)
+        {
+            return TtyError.BadMsg;
+        }
+        if (peer.size > 4)
+        {
+            peer.to_read = peer.size;
+            return;
+        }
+    }
+    defer
+    {
+        peer.readed = 0;
+        peer.to_read = 4;
+    }
+    const s = try parse.parse_t.create_from_slice(&g_allocator,
+            ins.data[4..peer.readed]);
+    defer s.delete();
+    if (peer.code == g_msg_request)
+    {
+        try process_request(info, peer, s);
+    }
+    else if (peer.code == g_msg_subscribe)
+    {
+        try process_subscribe(info, peer, s);
+    }
+    else if (peer.code == g_msg_get)
+    {
+        try process_get(info, peer, s);
+    }
+    // anything else from a peer is ignored
 }
 
 //*****************************************************************************
-fn print_tty_info(info: *tty_info_t) !void
+// bus threads only poll when someone is listening
+fn update_peer_count(info: *tty_info_t) void
 {
-    try log.logln(log.LogLevel.info, @src(),
-            "tty info: tty_name [{s}] modbus_debug [{}]",
-            .{std.mem.sliceTo(&info.tty, 0), info.modbus_debug});
-    try log.logln(log.LogLevel.info, @src(),
-            "  item_mstime [{}] list_mstime [{}]",
-            .{info.item_mstime, info.list_mstime});
-    try log.logln(log.LogLevel.info, @src(),
-            "  got [{}] item to monitor", .{info.id_list.items.len});
-    for (0..info.id_list.items.len) |index|
+    const peer_count = info.peer_list.items.len;
+    if (info.peer_count.swap(peer_count, .acq_rel) != peer_count)
     {
-        const item = &info.id_list.items[index];
-        try log.logln(log.LogLevel.info, @src(),
-                "    index {} item id {} address {} count {} " ++
-                "input address {} input count {}",
-                .{index, item.id, item.read_address, item.read_count,
-                item.read_input_address, item.read_input_count});
+        for (info.bus_list.items) |abus|
+        {
+            abus.send_cmd(tty_bus.g_cmd_peers);
+        }
     }
 }
 
 //*****************************************************************************
-fn hexdump_slice(slice: []u16) !void
+fn start_buses(info: *tty_info_t) !void
 {
-    var u8_slice: []u8 = undefined;
-    u8_slice.ptr = @ptrCast(slice.ptr);
-    u8_slice.len = slice.len * 2;
-    try hexdump.printHexDump(0, u8_slice);
+    for (info.bus_list.items) |abus|
+    {
+        try abus.start();
+    }
 }
 
 //*****************************************************************************
-fn process_tty_id_info(info: *tty_info_t, id_info: *tty_id_info_t) !void
+fn stop_buses(info: *tty_info_t) void
 {
-    var err = c.modbus_set_slave(info.ctx, id_info.id);
-    try log.logln_devel(log.LogLevel.info, @src(),
-            "set slave id {} err {}",
-            .{id_info.id, err});
-    try err_if(err != 0, TtyError.ModbusSetSlaveFailed);
-    if (info.id_list_sub_index == 1)
-    {
-        var regs: []u16 = undefined;
-        const count = id_info.read_count;
-        regs = try g_allocator.alloc(u16, count);
-        defer g_allocator.free(regs);
-        err = c.modbus_read_registers(info.ctx,
-                id_info.read_address, count, regs.ptr);
-        try log.logln_devel(log.LogLevel.info, @src(),
-                "modbus_read_registers read address {} err {}",
-                .{id_info.read_address, err});
-        if (err != count)
-        {
-            try log.logln(log.LogLevel.info, @src(),
-                    "modbus_read_registers err != count {} != {}",
-                    .{err, count});
-            return TtyError.ModbusReadRegistersFailed;
-        }
-        if (info.modbus_debug)
-        {
-            try hexdump_slice(regs);
-        }
-        // add data to each peer
-        try log.logln_devel(log.LogLevel.info, @src(), "peer len {}",
-                .{info.peer_list.items.len});
-        for (info.peer_list.items) |*aitem|
-        {
-            const msg_size = 2 + 2 + 2 + 2 + 2 + 2 + count * 2;
-            var s = try parse.parse_t.create(&g_allocator, msg_size);
-            defer s.delete();
-            try s.check_rem(msg_size);
-            s.out_u16_le(0); // msg id
-            s.out_u16_le(msg_size); // size
-            s.out_u16_le(0); // type
-            s.out_u16_le(id_info.id);
-            s.out_u16_le(id_info.read_address);
-            s.out_u16_le(id_info.read_count);
-            for (regs) |areg|
-            {
-                s.out_u16_le(areg);
-            }
-            const s_slice = s.get_out_slice();
-            const send = try g_allocator.create(send_t);
-            const out_data_slice = try g_allocator.alloc(u8, s_slice.len);
-            send.* = .{.out_data_slice = out_data_slice};
-            std.mem.copyForwards(u8, send.out_data_slice, s_slice);
-            if (aitem.send_tail) |asend_tail|
-            {
-                asend_tail.next = send;
-                aitem.send_tail = send;
-            }
-            else
-            {
-                aitem.send_head = send;
-                aitem.send_tail = send;
-            }
-        }
-    }
-    else if (info.id_list_sub_index == 2)
+    for (info.bus_list.items) |abus|
     {
-        var regs: []u16 = undefined;
-        const count = id_info.read_input_count;
-        regs = try g_allocator.alloc(u16, count);
-        defer g_allocator.free(regs);
-        err = c.modbus_read_input_registers(info.ctx,
-                id_info.read_input_address, count, regs.ptr);
-        try log.logln_devel(log.LogLevel.info, @src(),
-                "modbus_read_input_registers read address {} err {}",
-                .{id_info.read_input_address, err});
-        if (err != count)
-        {
-            try log.logln(log.LogLevel.info, @src(),
-                    "modbus_read_input_registers err != count {} != {}",
-                    .{err, count});
-            return TtyError.ModbusReadRegistersFailed;
-        }
-        if (info.modbus_debug)
-        {
-            try hexdump_slice(regs);
-        }
-        // add data to each peer
-        try log.logln_devel(log.LogLevel.info, @src(), "peer len {}",
-                .{info.peer_list.items.len});
-        for (info.peer_list.items) |*aitem|
-        {
-            const msg_size = 2 + 2 + 2 + 2 + 2 + 2 + count * 2;
-            var s = try parse.parse_t.create(&g_allocator, msg_size);
-            defer s.delete();
-            try s.check_rem(msg_size);
-            s.out_u16_le(0); // msg id
-            s.out_u16_le(msg_size); // size
-            s.out_u16_le(1); // type
-            s.out_u16_le(id_info.id);
-            s.out_u16_le(id_info.read_input_address);
-            s.out_u16_le(id_info.read_input_count);
-            for (regs) |areg|
-            {
-                s.out_u16_le(areg);
-            }
-            const s_slice = s.get_out_slice();
-            const send = try g_allocator.create(send_t);
-            const out_data_slice = try g_allocator.alloc(u8, s_slice.len);
-            send.* = .{.out_data_slice = out_data_slice};
-            std.mem.copyForwards(u8, send.out_data_slice, s_slice);
-            if (aitem.send_tail) |asend_tail|
-            {
-                asend_tail.next = send;
-                aitem.send_tail = send;
-            }
-            else
-            {
-                aitem.send_head = send;
-                aitem.send_tail = send;
-            }
-        }
+        abus.stop();
     }
 }
 
 //*****************************************************************************
-fn check_modbus(info: *tty_info_t, timeout: *i32) !void
+fn add_peer(info: *tty_info_t, sck: i32) !void
 {
-    var now = std.time.milliTimestamp();
-    var nmt = info.next_modbus_time orelse now;
-    const fmt = info.first_modbus_time orelse now;
-    const lmt = info.last_modbus_time orelse 0;
-    if ((now >= nmt) and (now - lmt < info.min_mstime))
+    const peer = try g_allocator.create(tty_peer_info_t);
+    peer.init() catch |err|
     {
-        // safety check, can not let 2 process_tty_id_info calls
-        // too close together
-        try log.logln_devel(log.LogLevel.info, @src(),
-                "adjusting next_modbus_time " ++
-                "now {} " ++
-                "last_modbus_time {} " ++
-                "diff {}",
-                .{now, lmt, now - lmt});
-        nmt = lmt + info.min_mstime;
-        info.next_modbus_time = nmt;
-        info.first_modbus_time = nmt;
+        g_allocator.destroy(peer);
+        posix.close(sck);
+        return err;
+    };
+    peer.sck = sck;
+    errdefer
+    {
+        peer.deinit(info);
+        g_allocator.destroy(peer);
     }
-    else if (now >= nmt)
+    peer.peer_id = info.next_peer_id;
+    info.next_peer_id +%= 1;
+    if (info.next_peer_id == 0)
     {
-        const id_info = info.get_next_id_info();
-        if (id_info) |aid_info|
-        {
-            info.next_modbus_time = now + info.item_mstime;
-            try process_tty_id_info(info, aid_info);
-            now = std.time.milliTimestamp();
-            info.last_modbus_time = now;
-        }
-        else
-        {
-            nmt = fmt + info.list_mstime;
-            info.next_modbus_time = nmt;
-            info.first_modbus_time = nmt;
-        }
+        info.next_peer_id = 1;
     }
-    // calculate timeout
-    timeout.* = @intCast(nmt - now);
-    timeout.* = @max(timeout.*, 0);
+    try info.peer_list.append(g_allocator, peer);
+    errdefer _ = info.peer_list.pop();
+    try info.peer_map.put(g_allocator, sck, peer);
+    errdefer _ = info.peer_map.remove(sck);
+    var event = peer_event(peer, false);
+    try posix.epoll_ctl(info.epfd, linux.EPOLL.CTL_ADD, sck, &event);
+    const sent = try send_cached(info, peer, null);
+    try log.logln_devel(log.LogLevel.info, @src(),
+            "peer sck {} sent {} cached", .{sck, sent});
+    update_peer_count(info);
+    update_status_ids(info);
 }
 
 //*****************************************************************************
-fn get_peer_by_sck(info: *tty_info_t, sck: i32) !*tty_peer_info_t
+fn remove_peer(info: *tty_info_t, peer: *tty_peer_info_t) void
 {
-    for (info.peer_list.items) |*peer|
+    if (info.epfd != -1)
+    {
+        posix.epoll_ctl(info.epfd, linux.EPOLL.CTL_DEL, peer.sck,
+                null) catch {};
+    }
+    _ = info.peer_map.remove(peer.sck);
+    if (peer.dirty)
+    {
+        for (info.dirty.items, 0..) |aitem, index|
+        {
+            if (aitem == peer)
+            {
+                _ = info.dirty.swapRemove(index);
+                break;
+            }
+        }
+    }
+    for (info.peer_list.items, 0..) |aitem, index|
     {
-        if (peer.sck == sck)
+        if (aitem == peer)
         {
-            return peer;
+            _ = info.peer_list.swapRemove(index);
+            break;
         }
     }
-    return TtyError.PeerNotFound;
+    peer.deinit(info);
+    g_allocator.destroy(peer);
+    update_peer_count(info);
+    update_status_ids(info);
 }
 
 //*****************************************************************************
-fn check_peers(info: *tty_info_t, active_polls: []posix.pollfd,
-        peers_index: usize, poll_count: usize) !void
+// events is EPOLL bits for peer's sck, errors close the peer
+fn check_peer(info: *tty_info_t, peer: *tty_peer_info_t, events: u32) !void
 {
-    for (peers_index..poll_count) |index|
+    const fd = peer.sck;
+    if ((events & (linux.EPOLL.IN | linux.EPOLL.HUP | linux.EPOLL.ERR)) != 0)
     {
-        const fd = active_polls[index].fd;
-        if ((active_polls[index].revents & posix.POLL.IN) != 0)
+        // data in from peer
+        try log.logln(log.LogLevel.info, @src(),
+                "POLL.IN set for sck {}", .{fd});
+        process_peer_in(info, peer) catch |err|
         {
-            // data in from peer
             try log.logln(log.LogLevel.info, @src(),
-                    "POLL.IN set for sck {}", .{fd});
-            const peer = try get_peer_by_sck(info, fd);
-            const in_slice = peer.ins.data[peer.ins.offset..];
-            const read = posix.recv(peer.sck, in_slice, 0) catch 0;
-            if (read < 1)
+                    "removing sck {} {}", .{fd, err});
+            return remove_peer(info, peer);
+        };
+    }
+    if ((events & linux.EPOLL.OUT) != 0)
+    {
+        // data out to peer, until it is all gone or the socket is full
+        try log.logln_devel(log.LogLevel.info, @src(),
+                "POLL.OUT set for sck {}", .{fd});
+        while (peer.has_sends())
+        {
+            const sent = send_peer(info, peer) catch |err|
             {
                 try log.logln(log.LogLevel.info, @src(),
-                        "delme set for sck {}", .{fd});
-                peer.delme = true;
-            }
-
-        }
-        if ((active_polls[index].revents & posix.POLL.OUT) != 0)
-        {
-            // data out to peer
+                        "removing sck {} {}", .{fd, err});
+                return remove_peer(info, peer);
+            };
             try log.logln_devel(log.LogLevel.info, @src(),
-                    "POLL.OUT set for sck {}", .{fd});
-            const peer = try get_peer_by_sck(info, fd);
-            try log.logln_devel(log.LogLevel.info, @src(),
-                    "peer sck {}",
-                    .{peer.sck});
-            if (peer.send_head) |asend|
-            {
-                const out_slice = asend.out_data_slice[asend.sent..];
-                const sent = posix.send(peer.sck, out_slice, 0) catch 0;
-                try log.logln_devel(log.LogLevel.info, @src(),
-                        "posix.send rv {}",
-                        .{sent});
-                if (sent > 0)
-                {
-                    asend.sent += sent;
-                    if (asend.sent >= asend.out_data_slice.len)
-                    {
-                        peer.send_head = asend.next;
-                        if (peer.send_head == null)
-                        {
-                            // if send_head is null, set send_tail to null
-                            peer.send_tail = null;
-                        }
-                        g_allocator.free(asend.out_data_slice);
-                        g_allocator.destroy(asend);
-                    }
-                }
-                else
-                {
-                    try log.logln(log.LogLevel.info, @src(),
-                            "delme set for sck {}", .{fd});
-                    peer.delme = true;
-                }
-            }
-            else
+                    "send_peer rv {}", .{sent});
+            if (sent < 1)
             {
-                try log.logln(log.LogLevel.info, @src(),
-                        "no data for src {}", .{fd});
+                break;
             }
         }
+        arm_peer(info, peer) catch |err|
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "removing sck {} {}", .{fd, err});
+            return remove_peer(info, peer);
+        };
     }
-    // check for delme peers
-    var jndex = info.peer_list.items.len;
-    while (jndex > 0)
+}
+
+//*****************************************************************************
+fn setup_tty_info(info: *tty_info_t, config_file: []const u8) !void
+{
+    try toml.setup_tty_info(&g_allocator, info, config_file);
+    for (info.bus_list.items) |abus|
     {
-        jndex -= 1;
-        const peer = &info.peer_list.items[jndex];
-        if (peer.delme)
-        {
-            peer.deinit();
-            _ = info.peer_list.swapRemove(jndex);
-        }
+        try plan.plan_reads(&g_allocator, abus);
     }
 }
 
@@ -536,26 +1513,29 @@ fn reload_config(info: *tty_info_t) !void
     const config_file = std.mem.sliceTo(&g_config_file, 0);
     var new_info: tty_info_t = undefined;
     try new_info.init();
-    if (toml.setup_tty_info(&g_allocator, &new_info, config_file)) |_|
-    {
-        info.id_list.deinit(g_allocator);
-        info.id_list = new_info.id_list;
-        info.item_mstime = new_info.item_mstime;
-        info.list_mstime = new_info.list_mstime;
-        info.modbus_debug = new_info.modbus_debug;
-        info.id_list_index = 0;
-        info.id_list_sub_index = 0;
-        info.next_modbus_time = null;
-        info.first_modbus_time = null;
-        info.last_modbus_time = null;
-        new_info.peer_list.deinit(g_allocator);
-        const modbus_err = c.modbus_set_debug(info.ctx,
-                @intFromBool(info.modbus_debug));
-        if (modbus_err != 0)
+    if (setup_tty_info(&new_info, config_file)) |_|
+    {
+        // bus threads are stopped, swap in the new buses
+        deinit_bus_list(&info.bus_list);
+        info.bus_list = new_info.bus_list;
+        new_info.bus_list = .{};
+        for (info.bus_list.items) |abus|
         {
-            try log.logln(log.LogLevel.info, @src(),
-                    "modbus_set_debug failed {}", .{modbus_err});
+            abus.info = info;
         }
+        info.defaults = new_info.defaults;
+        // the main loop locks again when it is still on
+        if (info.mlockall and !new_info.mlockall)
+        {
+            rt.unlock_memory() catch |err|
+            {
+                try log.logln(log.LogLevel.info, @src(),
+                        "munlockall failed {}", .{err});
+            };
+        }
+        info.mlockall = new_info.mlockall;
+        new_info.deinit();
+        prune_cache(info);
         try print_tty_info(info);
         try log.logln(log.LogLevel.info, @src(),
                 "config reloaded ok", .{});
@@ -568,124 +1548,91 @@ fn reload_config(info: *tty_info_t) !void
     }
 }
 
+//*****************************************************************************
+fn epoll_add(epfd: i32, fd: i32) !void
+{
+    var event: linux.epoll_event = .{.events = linux.EPOLL.IN,
+            .data = .{.fd = fd}};
+    try posix.epoll_ctl(epfd, linux.EPOLL.CTL_ADD, fd, &event);
+}
+
 //*****************************************************************************
 fn tty_main_loop(info: *tty_info_t) !void
 {
-    const max_polls = 32;
-    var timeout: i32 = undefined;
-    var polls: [max_polls]posix.pollfd = undefined;
-    var poll_count: usize = undefined;
+    info.epfd = try posix.epoll_create1(linux.EPOLL.CLOEXEC);
+    defer
+    {
+        posix.close(info.epfd);
+        info.epfd = -1;
+    }
+    try epoll_add(info.epfd, g_term[0]);
+    try epoll_add(info.epfd, g_hup[0]);
+    try epoll_add(info.epfd, info.sck);
+    try epoll_add(info.epfd, g_usr1[0]);
+    // bus threads have data
+    try epoll_add(info.epfd, info.notify[0]);
+    // peers stay connected over a reload
+    for (info.peer_list.items) |aitem|
+    {
+        var event = peer_event(aitem, aitem.has_sends());
+        try posix.epoll_ctl(info.epfd, linux.EPOLL.CTL_ADD, aitem.sck,
+                &event);
+        aitem.out_armed = aitem.has_sends();
+    }
+    var events: [g_max_events]linux.epoll_event = undefined;
     while (true)
     {
-        timeout = -1;
-        if (info.peer_list.items.len == 0)
-        {
-            info.next_modbus_time = null;
-            info.first_modbus_time = null;
-            info.last_modbus_time = null;
-            info.id_list_index = 0;
-            info.id_list_sub_index = 0;
-        }
-        else
+        const count = posix.epoll_wait(info.epfd, &events, -1);
+        for (events[0..count]) |aevent|
         {
-            try check_modbus(info, &timeout);
-        }
-        try log.logln_devel(log.LogLevel.info, @src(),
-                "timeout {}", .{timeout});
-        // setup poll
-        poll_count = 0;
-        // setup terminate fd
-        const term_index = poll_count;
-        polls[poll_count].fd = g_term[0];
-        polls[poll_count].events = posix.POLL.IN;
-        polls[poll_count].revents = 0;
-        poll_count += 1;
-        // setup hup fd
-        const hup_index = poll_count;
-        polls[poll_count].fd = g_hup[0];
-        polls[poll_count].events = posix.POLL.IN;
-        polls[poll_count].revents = 0;
-        poll_count += 1;
-        // setup listen fd
-        const lsck_index = poll_count;
-        polls[poll_count].fd = info.sck;
-        polls[poll_count].events = posix.POLL.IN;
-        polls[poll_count].revents = 0;
-        poll_count += 1;
-        // add the peers
-        const peers_index = poll_count;
-        for (info.peer_list.items) |*aitem|
-        {
-            polls[poll_count].fd = aitem.sck;
-            polls[poll_count].events = posix.POLL.IN;
-            if (aitem.send_tail != null)
-            {
-                // we have data to write
-                polls[poll_count].events |= posix.POLL.OUT;
-            }
-            polls[poll_count].revents = 0;
-            poll_count += 1;
-        }
-        const active_polls = polls[0..poll_count];
-        const poll_rv = try posix.poll(active_polls, timeout);
-        if (poll_rv > 0)
-        {
-            if ((active_polls[term_index].revents & posix.POLL.IN) != 0)
+            const fd = aevent.data.fd;
+            if (fd == g_term[0])
             {
                 try log.logln(log.LogLevel.info, @src(), "{s}",
                         .{"term set shutting down"});
-                break;
+                return;
             }
-            if ((active_polls[hup_index].revents & posix.POLL.IN) != 0)
+            else if (fd == g_hup[0])
             {
                 var hup_buf: [4]u8 = undefined;
                 _ = posix.read(g_hup[0], &hup_buf) catch 0;
+                stop_buses(info);
                 try reload_config(info);
                 return error.Reload;
             }
-            if ((active_polls[lsck_index].revents & posix.POLL.IN) != 0)
+            else if (fd == g_usr1[0])
+            {
+                var usr1_buf: [4]u8 = undefined;
+                _ = posix.read(g_usr1[0], &usr1_buf) catch 0;
+                for (info.bus_list.items) |abus|
+                {
+                    abus.send_cmd(tty_bus.g_cmd_stats);
+                }
+            }
+            else if (fd == info.notify[0])
+            {
+                try check_msgs(info);
+            }
+            else if (fd == info.sck)
             {
                 // new connection in
                 try log.logln(log.LogLevel.info, @src(), "{s}",
                         .{"new connection in"});
                 const sck = try posix.accept(info.sck, null, null, 0);
-                var peer = try info.peer_list.addOne(g_allocator);
-                try peer.init();
-                peer.sck = sck;
+                try add_peer(info, sck);
             }
-            if (peers_index < poll_count)
+            else if (info.peer_map.get(fd)) |apeer|
             {
-                try check_peers(info, active_polls, peers_index, poll_count);
+                try check_peer(info, apeer, aevent.events);
             }
         }
+        if (info.uring) |*auring|
+        {
+            try flush_peers(info, auring);
+        }
     }
 }
 
-//*****************************************************************************
-fn process_tty_info(info: *tty_info_t) !void
-{
-    try log.logln(log.LogLevel.info, @src(), "", .{});
-    const er_mode: c.modbus_error_recovery_mode =
-            c.MODBUS_ERROR_RECOVERY_LINK | c.MODBUS_ERROR_RECOVERY_PROTOCOL;
-    var modbus_err = c.modbus_set_error_recovery(info.ctx, er_mode);
-    try err_if(modbus_err != 0, TtyError.ModbusSetErrorRecoveryFailed);
-    modbus_err = c.modbus_get_response_timeout(info.ctx,
-            &info.response_sec, &info.response_usec);
-    try err_if(modbus_err != 0, TtyError.ModbusGetResponseTimeoutFailed);
-    try log.logln(log.LogLevel.info, @src(),
-            "modbus_get_response_timeout: response_sec {} response_usec {}",
-            .{info.response_sec, info.response_usec});
-    info.min_mstime = (info.response_sec * 1000) + (info.response_usec / 1000);
-    modbus_err = c.modbus_connect(info.ctx);
-    try log.logln(log.LogLevel.info, @src(), "modbus_connect: err {}",
-            .{modbus_err});
-    try err_if(modbus_err != 0, TtyError.ModbusConnectFailed);
-    defer c.modbus_close(info.ctx);
-    modbus_err = c.modbus_set_debug(info.ctx, @intFromBool(info.modbus_debug));
-    try err_if(modbus_err != 0, TtyError.ModbusSetDebugFailed);
-    try tty_main_loop(info);
-}
-
 //*****************************************************************************
 fn show_command_line_args() !void
 {
@@ -720,6 +1667,64 @@ fn show_command_line_args1(writer: anytype) !void
     try writer.print("  -F: run in foreground\n", .{});
     try writer.print("  -D: run in background\n", .{});
     try writer.print("  -c: toml config file\n, defaults to tty0.toml", .{});
+    try writer.print("  --plan: print bus timing for the config and exit\n",
+            .{});
+    try writer.print("  --provision <baud>: move the slaves of each rtu " ++
+            "bus to baud,\n    update the config and exit, stop " ++
+            "tty_reader first\n", .{});
+    try writer.print("  --io-uring: send to peers with io_uring, falls " ++
+            "back to epoll\n", .{});
+    try writer.print("  --discover: scan ids 1 to 247 on each rtu bus and " ++
+            "print toml\n    for what answers, stop tty_reader first\n",
+            .{});
+}
+
+//*****************************************************************************
+fn show_discover(info: *tty_info_t) !void
+{
+    if ((builtin.zig_version.major == 0) and
+        (builtin.zig_version.minor < 15))
+    {
+        const stdout = std.io.getStdOut();
+        const writer = stdout.writer();
+        try discover.discover(writer, g_allocator, info);
+    }
+    else
+    {
+        var buf: [1024]u8 = undefined;
+        const stdout = std.fs.File.stdout();
+        var stdout_writer = stdout.writer(&buf);
+        const writer = &stdout_writer.interface;
+        try discover.discover(writer, g_allocator, info);
+        try writer.flush();
+    }
+}
+
+//*****************************************************************************
+fn show_plan(info: *tty_info_t) !void
+{
+    if ((builtin.zig_version.major == 0) and
+        (builtin.zig_version.minor < 15))
+    {
+        const stdout = std.io.getStdOut();
+        const writer = stdout.writer();
+        for (info.bus_list.items) |abus|
+        {
+            try plan.print_plan(writer, abus);
+        }
+    }
+    else
+    {
+        var buf: [1024]u8 = undefined;
+        const stdout = std.fs.File.stdout();
+        var stdout_writer = stdout.writer(&buf);
+        const writer = &stdout_writer.interface;
+        for (info.bus_list.items) |abus|
+        {
+            try plan.print_plan(writer, abus);
+        }
+        try writer.flush();
+    }
 }
 
 //*****************************************************************************
@@ -747,6 +1752,30 @@ fn process_args() !void
         {
             g_deamonize = false;
         }
+        else if (std.mem.eql(u8, slice_arg, "--plan"))
+        {
+            g_plan = true;
+        }
+        else if (std.mem.eql(u8, slice_arg, "--io-uring"))
+        {
+            g_io_uring = true;
+        }
+        else if (std.mem.eql(u8, slice_arg, "--discover"))
+        {
+            g_discover = true;
+        }
+        else if (std.mem.eql(u8, slice_arg, "--provision"))
+        {
+            index += 1;
+            if (index < count)
+            {
+                const slice_arg1 = std.mem.sliceTo(std.os.argv[index], 0);
+                g_provision_baud = std.fmt.parseInt(u32, slice_arg1, 10)
+                        catch return error.ShowCommandLine;
+                continue;
+            }
+            return error.ShowCommandLine;
+        }
         else if (std.mem.eql(u8, slice_arg, "-c"))
         {
             index += 1;
@@ -781,6 +1810,35 @@ pub fn main() !void
         }
         return err;
     }
+    if (g_plan)
+    {
+        var plan_info: tty_info_t = undefined;
+        try plan_info.init();
+        defer plan_info.deinit();
+        try setup_tty_info(&plan_info, std.mem.sliceTo(&g_config_file, 0));
+        return show_plan(&plan_info);
+    }
+    if (g_discover)
+    {
+        var discover_info: tty_info_t = undefined;
+        try discover_info.init();
+        defer discover_info.deinit();
+        try setup_tty_info(&discover_info,
+                std.mem.sliceTo(&g_config_file, 0));
+        return show_discover(&discover_info);
+    }
+    if (g_provision_baud != 0)
+    {
+        try log.init(&g_allocator, log.LogLevel.debug);
+        defer log.deinit();
+        var provision_info: tty_info_t = undefined;
+        try provision_info.init();
+        defer provision_info.deinit();
+        const provision_file = std.mem.sliceTo(&g_config_file, 0);
+        try setup_tty_info(&provision_info, provision_file);
+        return provision.provision(g_allocator, &provision_info,
+                provision_file, g_provision_baud);
+    }
     if (g_deamonize)
     {
         const rv = try posix.fork();
@@ -806,11 +1864,10 @@ pub fn main() !void
     try tty_info.init();
     defer tty_info.deinit();
     const config_file = std.mem.sliceTo(&g_config_file, 0);
-    try toml.setup_tty_info(&g_allocator, &tty_info, config_file);
-    // setup modbus
-    while (c.modbus_new_rtu(&tty_info.tty, 9600, 'N', 8, 1)) |actx|
+    try setup_tty_info(&tty_info, config_file);
+    // setup buses
+    while (true)
     {
-        defer c.modbus_free(actx);
         if (g_deamonize)
         {
             try log.initWithFile(&g_allocator, log.LogLevel.debug,
@@ -822,11 +1879,30 @@ pub fn main() !void
         }
         defer log.deinit();
 
-        try log.logln(log.LogLevel.info, @src(),
-                "modbus_new_rtu ok for {s}",
-                .{std.mem.sliceTo(&tty_info.tty, 0)});
-        tty_info.ctx = actx;
         try print_tty_info(&tty_info);
+        if (tty_info.mlockall)
+        {
+            rt.lock_memory() catch |err|
+            {
+                try log.logln(log.LogLevel.info, @src(),
+                        "mlockall failed {}", .{err});
+            };
+        }
+        // the ring lives across reloads
+        if (g_io_uring and (tty_info.uring == null))
+        {
+            var auring: uring.uring_t = .{};
+            if (auring.init()) |_|
+            {
+                tty_info.uring = auring;
+            }
+            else |err|
+            {
+                try log.logln(log.LogLevel.info, @src(),
+                        "io_uring init failed {}, falling back to epoll",
+                        .{err});
+            }
+        }
         // setup listen socket
         const listen_socket = std.mem.sliceTo(&tty_info.listen_socket, 0);
         posix.unlink(listen_socket) catch |err|
@@ -838,9 +1914,11 @@ pub fn main() !void
         const address_len = address.getOsSockLen();
         try posix.bind(tty_info.sck, &address.any, address_len);
         try posix.listen(tty_info.sck, 2);
-        // setup more modbus, loop
-        const process_tty_info_rv = process_tty_info(&tty_info);
-        if (process_tty_info_rv) |_|
+        // a thread for each bus, loop
+        try start_buses(&tty_info);
+        const tty_main_loop_rv = tty_main_loop(&tty_info);
+        stop_buses(&tty_info);
+        if (tty_main_loop_rv) |_|
         {
             break;
         }
@@ -851,9 +1929,186 @@ pub fn main() !void
                 continue;
             }
             try log.logln(log.LogLevel.info, @src(),
-                    "process_tty_info error {}", .{err});
+                    "tty_main_loop error {}", .{err});
             try tty_sleep(60000);
         }
     }
     try log.logln(log.LogLevel.info, @src(), "exit main", .{});
 }
+
+//*****************************************************************************
+// zig build test, the test blocks of the imported files
+test
+{
+    _ = plan;
+    _ = sched;
+    _ = @import("tty_rtu.zig");
+    _ = slave;
+    _ = @import("tty_sniff.zig");
+    _ = provision;
+    _ = discover;
+    _ = @import("tty_tcp.zig");
+    _ = tty_bus;
+}
+
+//*****************************************************************************
+test "tty_deadband_info_t moved and keyframes"
+{
+    var absolute = [_]f32{1.0, 0.0};
+    var percent = [_]f32{0.0, 10.0};
+    var last: [2]u16 = undefined;
+    var deadband: tty_deadband_info_t = .{.absolute = &absolute,
+            .percent = &percent, .keyframe_cycles = 3, .last = &last};
+    // nothing published yet
+    try std.testing.expect(deadband.moved(&.{100, 200}));
+    // inside 1 raw and 10% of 200
+    try std.testing.expect(!deadband.moved(&.{101, 210}));
+    // past both, against the last published, not the last read
+    try std.testing.expect(deadband.moved(&.{102, 200}));
+    try std.testing.expectEqual(@as(u16, 102), last[0]);
+    try std.testing.expect(!deadband.moved(&.{102, 200}));
+    try std.testing.expect(!deadband.moved(&.{102, 200}));
+    // third read since published
+    try std.testing.expect(deadband.moved(&.{102, 200}));
+    deadband.keyframe_cycles = 0;
+    var index: u32 = 0;
+    while (index < 10) : (index += 1)
+    {
+        try std.testing.expect(!deadband.moved(&.{102, 200}));
+    }
+}
+
+//*****************************************************************************
+test "tty_filter_t wants by code, id and register range"
+{
+    var filter: tty_filter_t = .{};
+    defer filter.deinit();
+    var msg: tty_msg_t = .{.s = undefined, .code = g_msg_regs, .id = 5,
+            .reg_type = g_reg_type_input, .address = 100, .count = 10};
+    // not subscribed is everything
+    try std.testing.expect(filter.wants(&msg));
+    try std.testing.expect(filter.want_ids(g_msg_status).isSet(9));
+    // status only, every id
+    filter.subscribed = true;
+    filter.codes = 1 << g_msg_status;
+    try std.testing.expect(!filter.wants(&msg));
+    try std.testing.expectEqual(@as(usize, 0),
+            filter.want_ids(g_msg_regs).count());
+    try std.testing.expect(filter.want_ids(g_msg_status).isSet(9));
+    // answers to its own requests always
+    msg.peer_id = 3;
+    try std.testing.expect(filter.wants(&msg));
+    msg.peer_id = 0;
+    // regs and status of input 105 to 109 of id 5, any type of id 6
+    filter.codes |= 1 << g_msg_regs;
+    try filter.ranges.append(g_allocator, .{.id = 5,
+            .reg_type = g_reg_type_input, .address = 105, .count = 5});
+    try filter.ranges.append(g_allocator, .{.id = 6});
+    filter.ids.set(5);
+    filter.ids.set(6);
+    try std.testing.expect(filter.wants(&msg));
+    try std.testing.expect(filter.want_ids(g_msg_status).isSet(5));
+    try std.testing.expect(!filter.want_ids(g_msg_status).isSet(9));
+    msg.address = 110;
+    try std.testing.expect(!filter.wants(&msg));
+    msg.address = 95;
+    msg.count = 10;
+    try std.testing.expect(!filter.wants(&msg));
+    msg.count = 11;
+    try std.testing.expect(filter.wants(&msg));
+    msg.reg_type = g_reg_type_holding;
+    try std.testing.expect(!filter.wants(&msg));
+    msg.id = 6;
+    try std.testing.expect(filter.wants(&msg));
+    msg.id = 7;
+    try std.testing.expect(!filter.wants(&msg));
+    msg.code = g_msg_cached;
+    msg.id = 6;
+    try std.testing.expect(!filter.wants(&msg));
+}
+
+//*****************************************************************************
+test "cache pruned on reload, snapshot sent to a new peer"
+{
+    var info: tty_info_t = undefined;
+    try info.init();
+    defer info.deinit();
+    const bus = try tty_bus.tty_bus_info_t.create(g_allocator, &info, 0,
+            &info.defaults);
+    info.bus_list.append(g_allocator, bus) catch |err|
+    {
+        bus.delete();
+        return err;
+    };
+    // id 1 holding 0 and 10, id 2 input 0
+    try bus.id_list.append(g_allocator, .{.id = 1});
+    try bus.id_list.items[0].blocks.append(g_allocator,
+            .{.address = 0, .count = 2});
+    try bus.id_list.items[0].blocks.append(g_allocator,
+            .{.address = 10, .count = 1});
+    try bus.id_list.append(g_allocator, .{.id = 2});
+    try bus.id_list.items[1].blocks.append(g_allocator,
+            .{.reg_type = g_reg_type_input, .count = 2});
+    var regs = [_]u16{1, 2};
+    try publish_block(&info, 1, g_reg_type_holding, 0, &regs);
+    regs[0] = 3;
+    try publish_block(&info, 1, g_reg_type_holding, 0, &regs);
+    try publish_block(&info, 1, g_reg_type_holding, 10, regs[0..1]);
+    try publish_block(&info, 2, g_reg_type_input, 0, &regs);
+    // what check_msgs does with no peers
+    var msg = info.msg_head;
+    info.msg_head = null;
+    info.msg_tail = null;
+    while (msg) |amsg|
+    {
+        msg = amsg.next;
+        defer info.release_msg(amsg);
+        try update_cache(&info, amsg);
+    }
+    // the second read of holding 0 replaced the first, only the cache
+    // holds it
+    try std.testing.expectEqual(@as(usize, 3), info.cache.count());
+    const first = info.cache.get(cache_key(g_reg_type_holding, 1, 0)) orelse
+            return error.TestUnexpectedResult;
+    try std.testing.expectEqual(@as(u32, 1), first.refs);
+    try std.testing.expectEqual(@as(u8, 3), first.data[12]);
+    // reload without id 2
+    bus.id_list.items[1].deinit();
+    bus.id_list.shrinkRetainingCapacity(1);
+    prune_cache(&info);
+    try std.testing.expectEqual(@as(usize, 2), info.cache.count());
+    try std.testing.expect(!info.cache.contains(
+            cache_key(g_reg_type_input, 2, 0)));
+    // a new peer gets the two blocks then the end
+    var peer: tty_peer_info_t = .{};
+    defer
+    {
+        for (peer.sends.items) |amsg|
+        {
+            info.release_msg(amsg);
+        }
+        peer.sends.deinit(g_allocator);
+    }
+    try std.testing.expectEqual(@as(u32, 2),
+            try send_cached(&info, &peer, null));
+    try std.testing.expectEqual(@as(usize, 3), peer.sends.items.len);
+    for (peer.sends.items, 0..) |amsg, index|
+    {
+        const code = std.mem.readInt(u16, amsg.data[0..2], .little);
+        const size = std.mem.readInt(u16, amsg.data[2..4], .little);
+        try std.testing.expectEqual(amsg.data.len, size);
+        if (index < 2)
+        {
+            try std.testing.expectEqual(g_msg_cached, code);
+            // age ahead of the g_msg_regs body
+            const body = info.cache.values()[index].data[4..];
+            try std.testing.expectEqualSlices(u8, body, amsg.data[8..]);
+        }
+        else
+        {
+            try std.testing.expectEqual(g_msg_cached_end, code);
+            try std.testing.expectEqual(@as(u32, 2),
+                    std.mem.readInt(u32, amsg.data[4..8], .little));
+        }
+    }
+}
@@ -30,7 +30,23 @@ pub fn main() !void
         const s = try parse.parse_t.create_from_slice(&g_allocator, recv_slice[0..recv_rv]);
         defer s.delete();
         try s.check_rem(recv_rv);
-        if (s.in_u16_le() == 0)
+        const code = s.in_u16_le();
+        if (code == 1) // status
+        {
+            if ((s.in_i16_le() >= 18) and (recv_rv >= 18))
+            {
+                const bus = s.in_u16_le();
+                const id = s.in_u16_le();
+                const type1 = s.in_u16_le();
+                const address1 = s.in_u16_le();
+                const count = s.in_u16_le();
+                const state = s.in_u16_le();
+                const reason = s.in_u16_le();
+                std.debug.print("bus {} id {} type {} address {} count {} state {} reason {}\n",
+                        .{bus, id, type1, address1, count, state, reason});
+            }
+        }
+        else if (code == 0)
         {
             if (s.in_i16_le() > 0) // size
             {
@@ -30,6 +30,13 @@ const heyu_info_t = struct
 
 var g_heyu_info: heyu_info_t = .{};
 
+// tty_reader g_msg_subscribe, only the battery voltage of the renogy
+const g_msg_subscribe: u16 = 4;
+const g_subscribe_codes: u16 = 1; // g_msg_regs
+const g_renogy_id: u16 = 9;
+const g_volts_address: u16 = 256; // percent and volts
+const g_volts_count: u16 = 2;
+
 const state_t = enum
 {
     LookingForLow,
@@ -400,6 +407,30 @@ fn charger_off() !void
             rv.stdout, rv.stderr});
 }
 
+//*****************************************************************************
+// ask tty_reader for only what process_msg looks at
+fn subscribe(info: *info_t) !void
+{
+    const msg_size = 2 + 2 + 2 + 2 + 2 + 2 + 2 + 2;
+    const s = try parse.parse_t.create(&g_allocator, msg_size);
+    defer s.delete();
+    try s.check_rem(msg_size);
+    s.out_u16_le(g_msg_subscribe);
+    s.out_u16_le(msg_size);
+    s.out_u16_le(g_subscribe_codes);
+    s.out_u16_le(1); // range count
+    s.out_u16_le(g_renogy_id);
+    s.out_u16_le(0); // holding
+    s.out_u16_le(g_volts_address);
+    s.out_u16_le(g_volts_count);
+    const out = s.get_out_slice();
+    var sent: usize = 0;
+    while (sent < out.len)
+    {
+        sent += try posix.send(info.csck, out[sent..], 0);
+    }
+}
+
 //*****************************************************************************
 fn process_msg(info: *info_t, s: *parse.parse_t) !void
 {
@@ -409,9 +440,9 @@ fn process_msg(info: *info_t, s: *parse.parse_t) !void
     const id = s.in_u16_le();
     const address1 = s.in_u16_le();
     const count = s.in_u16_le();
-    if ((type1 == 0) and (id == 9))
+    if ((type1 == 0) and (id == g_renogy_id))
     {
-        if (address1 == 256 and count == 10)
+        if (address1 == g_volts_address and count == 10)
         {
             try s.check_rem(4);
             s.in_u8_skip(2); // percent
@@ -651,6 +682,7 @@ pub fn main() !void
         defer posix.close(info.csck);
         const address_len = address.getOsSockLen();
         try posix.connect(info.csck, &address.any, address_len);
+        try subscribe(info);
         // loop
         const main_loop_rv = main_loop(info, ins);
         if (main_loop_rv) |_| { } else |err|
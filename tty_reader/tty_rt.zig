@@ -0,0 +1,70 @@
+const std = @import("std");
+const linux = std.os.linux;
+const posix = std.posix;
+
+pub const RtError = error
+{
+    RtSchedFailed,
+    RtAffinityFailed,
+    RtMlockFailed,
+    RtMunlockFailed,
+};
+
+const g_sched_fifo: usize = 1;
+const g_mcl_current: usize = 1;
+const g_mcl_future: usize = 2;
+
+//*****************************************************************************
+// SCHED_FIFO at priority for the calling thread, needs CAP_SYS_NICE or
+// an rtprio limit
+pub fn set_fifo(priority: u8) !void
+{
+    const param: c_int = priority;
+    const rc = linux.syscall3(.sched_setscheduler, 0, g_sched_fifo,
+            @intFromPtr(&param));
+    if (posix.errno(rc) != .SUCCESS)
+    {
+        return RtError.RtSchedFailed;
+    }
+}
+
+//*****************************************************************************
+// pin the calling thread to cpu
+pub fn set_affinity(cpu: u16) !void
+{
+    const bits = @bitSizeOf(usize);
+    var set = [_]usize{0} ** (1024 / bits);
+    if (cpu >= set.len * bits)
+    {
+        return RtError.RtAffinityFailed;
+    }
+    set[cpu / bits] = @as(usize, 1) << @intCast(cpu % bits);
+    const rc = linux.syscall3(.sched_setaffinity, 0, @sizeOf(@TypeOf(set)),
+            @intFromPtr(&set));
+    if (posix.errno(rc) != .SUCCESS)
+    {
+        return RtError.RtAffinityFailed;
+    }
+}
+
+//*****************************************************************************
+// no page faults on the bus threads, for the whole process
+pub fn lock_memory() !void
+{
+    const rc = linux.syscall1(.mlockall, g_mcl_current | g_mcl_future);
+    if (posix.errno(rc) != .SUCCESS)
+    {
+        return RtError.RtMlockFailed;
+    }
+}
+
+//*****************************************************************************
+// undo lock_memory, a reload that turns mlockall off
+pub fn unlock_memory() !void
+{
+    const rc = linux.syscall0(.munlockall);
+    if (posix.errno(rc) != .SUCCESS)
+    {
+        return RtError.RtMunlockFailed;
+    }
+}
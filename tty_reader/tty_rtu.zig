@@ -0,0 +1,581 @@
+const std = @import("std");
+const log = @import("log");
+const hexdump = @import("hexdump");
+const plan = @import("tty_plan.zig");
+const posix = std.posix;
+const c = @cImport(
+{
+    @cInclude("termios.h");
+    @cInclude("sys/ioctl.h");
+    @cInclude("linux/serial.h");
+});
+
+pub const RtuError = error
+{
+    RtuBusy,
+    RtuBadBaud,
+    RtuBadParity,
+    RtuTcgetattrFailed,
+    RtuTcsetattrFailed,
+    RtuFrameTooBig,
+    RtuTimeout,
+    RtuCrcError,
+    RtuFramingError,
+    RtuBadResponse,
+    RtuException,
+    RtuLowLatencyFailed,
+};
+
+// largest rtu frame, id + pdu(253) + crc
+pub const g_max_adu: usize = 256;
+// USB serial adapters hand bytes over in bursts up to their latency timer,
+// so frame end by silence alone needs more than 3.5 characters
+const g_min_frame_gap_us: i64 = 20000;
+
+//*****************************************************************************
+fn init_crc_table() [256]u16
+{
+    @setEvalBranchQuota(10000);
+    var table: [256]u16 = undefined;
+    for (0..256) |index|
+    {
+        var crc: u16 = @intCast(index);
+        for (0..8) |_|
+        {
+            if ((crc & 1) != 0)
+            {
+                crc = (crc >> 1) ^ 0xA001;
+            }
+            else
+            {
+                crc = crc >> 1;
+            }
+        }
+        table[index] = crc;
+    }
+    return table;
+}
+
+const g_crc_table: [256]u16 = init_crc_table();
+
+//*****************************************************************************
+// modbus crc16, sent low byte first
+pub fn crc16(data: []const u8) u16
+{
+    var crc: u16 = 0xFFFF;
+    for (data) |abyte|
+    {
+        crc = (crc >> 8) ^ g_crc_table[(crc ^ abyte) & 0xFF];
+    }
+    return crc;
+}
+
+//*****************************************************************************
+// total length of the rtu response frame in data, null if it can not be
+// known yet or the function has no fixed size
+pub fn expected_len(data: []const u8) ?usize
+{
+    if (data.len < 2)
+    {
+        return null;
+    }
+    const function = data[1];
+    if ((function & 0x80) != 0)
+    {
+        return 5; // id, function, exception code, crc
+    }
+    switch (function)
+    {
+        0x01, 0x02, 0x03, 0x04, 0x17 =>
+        {
+            if (data.len < 3)
+            {
+                return null;
+            }
+            return 5 + @as(usize, data[2]);
+        },
+        0x05, 0x06, 0x0F, 0x10 => return 8,
+        0x42 => return 4, // pzem energy reset, echoed
+        else => return null,
+    }
+}
+
+//*****************************************************************************
+// pdu to read count registers at address
+pub fn read_pdu(buf: []u8, function: u8, address: u16, count: u16) []u8
+{
+    buf[0] = function;
+    std.mem.writeInt(u16, buf[1..3], address, .big);
+    std.mem.writeInt(u16, buf[3..5], count, .big);
+    return buf[0..5];
+}
+
+//*****************************************************************************
+// registers out of a 0x03, 0x04 or 0x17 response pdu
+pub fn regs_from_pdu(pdu: []const u8, regs: []u16) !void
+{
+    if ((pdu.len < 2) or (pdu[1] != regs.len * 2) or
+            (pdu.len != 2 + regs.len * 2))
+    {
+        return RtuError.RtuBadResponse;
+    }
+    for (regs, 0..) |*areg, index|
+    {
+        areg.* = std.mem.readInt(u16, pdu[2 + index * 2..][0..2], .big);
+    }
+}
+
+//*****************************************************************************
+fn speed_from_baud(baud: u32) !c.speed_t
+{
+    switch (baud)
+    {
+        1200 => return c.B1200,
+        2400 => return c.B2400,
+        4800 => return c.B4800,
+        9600 => return c.B9600,
+        19200 => return c.B19200,
+        38400 => return c.B38400,
+        57600 => return c.B57600,
+        115200 => return c.B115200,
+        230400 => return c.B230400,
+        else => return RtuError.RtuBadBaud,
+    }
+}
+
+//*****************************************************************************
+// usb serial adapters like the FTDI hold received bytes up to their
+// latency timer, 16 ms by default, set it through sysfs
+pub fn set_latency_timer(tty_name: []const u8, mstime: u8) !void
+{
+    var real_buf: [std.fs.max_path_bytes]u8 = undefined;
+    // /dev/serial/by-id/... links to /dev/ttyUSBn
+    const real = try std.fs.realpath(tty_name, &real_buf);
+    var path_buf: [std.fs.max_path_bytes]u8 = undefined;
+    const path = try std.fmt.bufPrint(&path_buf,
+            "/sys/bus/usb-serial/devices/{s}/latency_timer",
+            .{std.fs.path.basename(real)});
+    var file = try std.fs.openFileAbsolute(path, .{.mode = .write_only});
+    defer file.close();
+    var val_buf: [8]u8 = undefined;
+    try file.writeAll(try std.fmt.bufPrint(&val_buf, "{}\n", .{mstime}));
+}
+
+//*****************************************************************************
+// true if open() can set baud
+pub fn baud_ok(baud: u32) bool
+{
+    _ = speed_from_baud(baud) catch return false;
+    return true;
+}
+
+pub const rtu_state_t = enum
+{
+    Idle,
+    Sending,
+    Waiting,
+    Done,
+};
+
+// one outstanding request at a time on a half duplex bus, every call is
+// non blocking, the owner polls fd for poll_events() and calls check()
+// on every loop
+pub const rtu_t = struct
+{
+    fd: i32 = -1,
+    baud: u32 = 9600,
+    char_bits: u64 = 10, // start, data, parity and stop
+    debug: bool = false,
+    response_us: i64 = 500000,
+    silence_us: i64 = 0, // 3.5 characters
+    frame_gap_us: i64 = 0, // silence that ends a frame of unknown size
+    state: rtu_state_t = .Idle,
+    tx: [g_max_adu]u8 = undefined,
+    tx_len: usize = 0,
+    tx_sent: usize = 0,
+    rx: [g_max_adu]u8 = undefined,
+    rx_len: usize = 0,
+    bus_idle_us: i64 = 0, // time of the last byte seen or sent
+    start_us: i64 = 0, // time start() was called
+    sent_us: i64 = 0, // time the request was fully written
+    // how long after it could go the first byte was written, scheduling
+    send_late_us: i64 = 0,
+    first_byte_us: ?i64 = null, // time the first response byte came in
+    err: ?RtuError = null, // result once Done, null is ok
+
+    //*************************************************************************
+    pub fn open(self: *rtu_t, tty_name: []const u8, baud: u32, parity: u8,
+            data_bits: u8, stop_bits: u8) !void
+    {
+        self.* = .{.baud = baud,
+                .char_bits = plan.frame_bits(parity, data_bits, stop_bits)};
+        const speed = try speed_from_baud(baud);
+        self.fd = try posix.open(tty_name,
+                .{.ACCMODE = .RDWR, .NOCTTY = true, .NONBLOCK = true}, 0);
+        errdefer self.close();
+        var tio: c.struct_termios = undefined;
+        if (c.tcgetattr(self.fd, &tio) != 0)
+        {
+            return RtuError.RtuTcgetattrFailed;
+        }
+        c.cfmakeraw(&tio);
+        _ = c.cfsetispeed(&tio, speed);
+        _ = c.cfsetospeed(&tio, speed);
+        tio.c_cflag |= c.CLOCAL | c.CREAD;
+        tio.c_cflag &= ~@as(c.tcflag_t, c.CSIZE);
+        tio.c_cflag |= switch (data_bits)
+        {
+            7 => @as(c.tcflag_t, c.CS7),
+            else => @as(c.tcflag_t, c.CS8),
+        };
+        if (stop_bits == 2)
+        {
+            tio.c_cflag |= c.CSTOPB;
+        }
+        else
+        {
+            tio.c_cflag &= ~@as(c.tcflag_t, c.CSTOPB);
+        }
+        switch (parity)
+        {
+            'N' => tio.c_cflag &= ~@as(c.tcflag_t, c.PARENB | c.PARODD),
+            'E' =>
+            {
+                tio.c_cflag |= c.PARENB;
+                tio.c_cflag &= ~@as(c.tcflag_t, c.PARODD);
+            },
+            'O' => tio.c_cflag |= c.PARENB | c.PARODD,
+            else => return RtuError.RtuBadParity,
+        }
+        tio.c_cc[c.VMIN] = 0;
+        tio.c_cc[c.VTIME] = 0;
+        if (c.tcsetattr(self.fd, c.TCSANOW, &tio) != 0)
+        {
+            return RtuError.RtuTcsetattrFailed;
+        }
+        _ = c.tcflush(self.fd, c.TCIOFLUSH);
+        self.silence_us = @intCast(plan.silence_us(baud, self.char_bits));
+        self.frame_gap_us = @max(self.silence_us, g_min_frame_gap_us);
+    }
+
+    //*************************************************************************
+    // ASYNC_LOW_LATENCY, the driver pushes each received byte up at once
+    // instead of batching, not every driver has it
+    pub fn set_low_latency(self: *rtu_t) !void
+    {
+        var ss: c.struct_serial_struct = undefined;
+        if (c.ioctl(self.fd, c.TIOCGSERIAL, &ss) != 0)
+        {
+            return RtuError.RtuLowLatencyFailed;
+        }
+        ss.flags |= @as(c_int, @intCast(c.ASYNC_LOW_LATENCY));
+        if (c.ioctl(self.fd, c.TIOCSSERIAL, &ss) != 0)
+        {
+            return RtuError.RtuLowLatencyFailed;
+        }
+    }
+
+    //*************************************************************************
+    // drop what the tty received and nobody read yet
+    pub fn flush_input(self: *rtu_t) void
+    {
+        _ = c.tcflush(self.fd, c.TCIFLUSH);
+    }
+
+    //*************************************************************************
+    pub fn close(self: *rtu_t) void
+    {
+        if (self.fd != -1)
+        {
+            posix.close(self.fd);
+            self.fd = -1;
+        }
+        self.state = .Idle;
+    }
+
+    //*************************************************************************
+    // queue a request, pdu is function code and data, it goes on the wire
+    // once the bus has been silent for 3.5 characters
+    pub fn start(self: *rtu_t, slave: u8, pdu: []const u8, now_us: i64) !void
+    {
+        if (self.state != .Idle)
+        {
+            return RtuError.RtuBusy;
+        }
+        if (pdu.len + 3 > g_max_adu)
+        {
+            return RtuError.RtuFrameTooBig;
+        }
+        self.tx[0] = slave;
+        std.mem.copyForwards(u8, self.tx[1..], pdu);
+        const crc = crc16(self.tx[0..pdu.len + 1]);
+        std.mem.writeInt(u16, self.tx[pdu.len + 1..][0..2], crc, .little);
+        self.tx_len = pdu.len + 3;
+        self.tx_sent = 0;
+        self.rx_len = 0;
+        self.first_byte_us = null;
+        self.err = null;
+        self.start_us = now_us;
+        self.state = .Sending;
+        try self.check(now_us);
+    }
+
+    //*************************************************************************
+    pub fn poll_events(self: *rtu_t) i16
+    {
+        var events: i16 = posix.POLL.IN;
+        if ((self.state == .Sending) and (self.tx_sent > 0))
+        {
+            events |= posix.POLL.OUT;
+        }
+        return events;
+    }
+
+    //*************************************************************************
+    // milliseconds until check() has something to do, -1 for never
+    pub fn timeout_ms(self: *rtu_t, now_us: i64) i32
+    {
+        var due_us: i64 = undefined;
+        switch (self.state)
+        {
+            .Sending =>
+            {
+                if (self.tx_sent > 0)
+                {
+                    return -1; // waiting on POLL.OUT
+                }
+                due_us = self.bus_idle_us + self.silence_us;
+            },
+            .Waiting => due_us = self.wait_due_us(),
+            .Idle, .Done => return -1,
+        }
+        const rv = @divTrunc(due_us - now_us + 999, 1000);
+        return @intCast(std.math.clamp(rv, 0, 60000));
+    }
+
+    //*************************************************************************
+    fn wait_due_us(self: *rtu_t) i64
+    {
+        if (self.rx_len < 1)
+        {
+            return self.sent_us + self.response_us;
+        }
+        if (expected_len(self.rx[0..self.rx_len])) |aexpected_len|
+        {
+            // partial frame of known size, allow for its wire time
+            const wire: i64 = @intCast(plan.wire_us(self.baud,
+                    self.char_bits, aexpected_len));
+            return self.sent_us + self.response_us + wire;
+        }
+        return self.bus_idle_us + self.frame_gap_us;
+    }
+
+    //*************************************************************************
+    fn finish(self: *rtu_t, err: ?RtuError) !void
+    {
+        self.err = err;
+        self.state = .Done;
+        if (self.debug)
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "rx {} bytes", .{self.rx_len});
+            try hexdump.printHexDump(0, self.rx[0..self.rx_len]);
+        }
+    }
+
+    //*************************************************************************
+    fn check_frame(self: *rtu_t) !void
+    {
+        const frame = self.rx[0..self.rx_len];
+        if (frame.len < 4)
+        {
+            return self.finish(RtuError.RtuFramingError);
+        }
+        const crc = std.mem.readInt(u16, frame[frame.len - 2..][0..2],
+                .little);
+        if (crc != crc16(frame[0..frame.len - 2]))
+        {
+            return self.finish(RtuError.RtuCrcError);
+        }
+        if ((frame[0] != self.tx[0]) or ((frame[1] & 0x7F) != self.tx[1]))
+        {
+            return self.finish(RtuError.RtuBadResponse);
+        }
+        if ((frame[1] & 0x80) != 0)
+        {
+            return self.finish(RtuError.RtuException);
+        }
+        return self.finish(null);
+    }
+
+    //*************************************************************************
+    fn write_some(self: *rtu_t, now_us: i64) !void
+    {
+        const out_slice = self.tx[self.tx_sent..self.tx_len];
+        const sent = posix.write(self.fd, out_slice) catch |err|
+        {
+            if (err == error.WouldBlock)
+            {
+                return;
+            }
+            return err;
+        };
+        self.tx_sent += sent;
+        self.bus_idle_us = now_us;
+        if (self.tx_sent >= self.tx_len)
+        {
+            if (self.debug)
+            {
+                try log.logln(log.LogLevel.info, @src(),
+                        "tx {} bytes", .{self.tx_len});
+                try hexdump.printHexDump(0, self.tx[0..self.tx_len]);
+            }
+            // the request is on the wire after its transmit time
+            const wire: i64 = @intCast(plan.wire_us(self.baud,
+                    self.char_bits, self.tx_len));
+            self.sent_us = now_us + wire;
+            self.bus_idle_us = self.sent_us;
+            self.state = .Waiting;
+        }
+    }
+
+    //*************************************************************************
+    pub fn on_writable(self: *rtu_t, now_us: i64) !void
+    {
+        if (self.state == .Sending)
+        {
+            try self.write_some(now_us);
+        }
+    }
+
+    //*************************************************************************
+    pub fn on_readable(self: *rtu_t, now_us: i64) !void
+    {
+        while (true)
+        {
+            var buf: [g_max_adu]u8 = undefined;
+            const read = posix.read(self.fd, &buf) catch |err|
+            {
+                if (err == error.WouldBlock)
+                {
+                    return;
+                }
+                return err;
+            };
+            if (read < 1)
+            {
+                return;
+            }
+            self.bus_idle_us = now_us;
+            if (self.state != .Waiting)
+            {
+                // nobody asked, noise or another master, drop it
+                continue;
+            }
+            if (self.first_byte_us == null)
+            {
+                self.first_byte_us = now_us;
+            }
+            if (self.rx_len + read > self.rx.len)
+            {
+                return self.finish(RtuError.RtuFramingError);
+            }
+            std.mem.copyForwards(u8, self.rx[self.rx_len..], buf[0..read]);
+            self.rx_len += read;
+            if (expected_len(self.rx[0..self.rx_len])) |aexpected_len|
+            {
+                if (self.rx_len >= aexpected_len)
+                {
+                    self.rx_len = aexpected_len;
+                    return self.check_frame();
+                }
+            }
+        }
+    }
+
+    //*************************************************************************
+    // run the timers, call on every loop
+    pub fn check(self: *rtu_t, now_us: i64) !void
+    {
+        switch (self.state)
+        {
+            .Sending =>
+            {
+                const due_us = self.bus_idle_us + self.silence_us;
+                if ((self.tx_sent == 0) and (now_us >= due_us))
+                {
+                    self.send_late_us = now_us - @max(due_us, self.start_us);
+                    try self.write_some(now_us);
+                }
+            },
+            .Waiting =>
+            {
+                if (now_us < self.wait_due_us())
+                {
+                    return;
+                }
+                if (self.rx_len < 1)
+                {
+                    return self.finish(RtuError.RtuTimeout);
+                }
+                if (expected_len(self.rx[0..self.rx_len]) != null)
+                {
+                    return self.finish(RtuError.RtuFramingError);
+                }
+                // unknown size, the silence ended the frame
+                return self.check_frame();
+            },
+            .Idle, .Done => {},
+        }
+    }
+
+    //*************************************************************************
+    // response pdu, function code and data, valid when Done without err
+    pub fn pdu(self: *rtu_t) []const u8
+    {
+        return self.rx[1..self.rx_len - 2];
+    }
+
+    //*************************************************************************
+    // back to Idle after the owner is done with the result
+    pub fn reset(self: *rtu_t) void
+    {
+        self.state = .Idle;
+    }
+};
+
+//*****************************************************************************
+test "crc16 table"
+{
+    try std.testing.expectEqual(@as(u16, 0x4B37), crc16("123456789"));
+    // read 10 holding registers from slave 1, sent C5 CD
+    const frame = [_]u8{0x01, 0x03, 0x00, 0x00, 0x00, 0x0A};
+    try std.testing.expectEqual(@as(u16, 0xCDC5), crc16(&frame));
+}
+
+//*****************************************************************************
+test "expected_len"
+{
+    try std.testing.expectEqual(@as(?usize, null), expected_len(&.{1}));
+    try std.testing.expectEqual(@as(?usize, null),
+            expected_len(&.{1, 0x03}));
+    try std.testing.expectEqual(@as(?usize, 9),
+            expected_len(&.{1, 0x03, 4}));
+    try std.testing.expectEqual(@as(?usize, 5),
+            expected_len(&.{1, 0x83}));
+    try std.testing.expectEqual(@as(?usize, 8),
+            expected_len(&.{1, 0x10}));
+    try std.testing.expectEqual(@as(?usize, null),
+            expected_len(&.{1, 0x2B}));
+}
+
+//*****************************************************************************
+test "regs_from_pdu"
+{
+    var regs: [2]u16 = undefined;
+    try regs_from_pdu(&.{0x03, 4, 0x12, 0x34, 0x00, 0x01}, &regs);
+    try std.testing.expectEqual(@as(u16, 0x1234), regs[0]);
+    try std.testing.expectEqual(@as(u16, 1), regs[1]);
+    try std.testing.expectError(RtuError.RtuBadResponse,
+            regs_from_pdu(&.{0x03, 2, 0x12, 0x34}, &regs));
+}
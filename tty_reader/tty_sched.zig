@@ -0,0 +1,573 @@
+const std = @import("std");
+const tty = @import("tty_reader.zig");
+
+pub const g_hist_buckets: usize = 18;
+
+// log2 histogram in the caller's unit, bucket 0 is <= 0, bucket n is
+// 2^(n - 1) to 2^n - 1, the last bucket holds everything larger
+pub const hist_t = struct
+{
+    counts: [g_hist_buckets]u64 = .{0} ** g_hist_buckets,
+    total: u64 = 0,
+    sum: i64 = 0,
+    max: i64 = 0,
+
+    //*************************************************************************
+    pub fn add(self: *hist_t, value: i64) void
+    {
+        var index: usize = 0;
+        if (value > 0)
+        {
+            const bits: usize = 64 - @clz(@as(u64, @intCast(value)));
+            index = @min(bits, g_hist_buckets - 1);
+        }
+        self.counts[index] += 1;
+        self.total += 1;
+        self.sum += value;
+        self.max = @max(self.max, value);
+    }
+
+    //*************************************************************************
+    // largest value that lands in bucket index
+    pub fn bucket_max(index: usize) i64
+    {
+        if (index < 1)
+        {
+            return 0;
+        }
+        return (@as(i64, 1) << @intCast(index)) - 1;
+    }
+
+    //*************************************************************************
+    pub fn mean(self: *const hist_t) i64
+    {
+        if (self.total < 1)
+        {
+            return 0;
+        }
+        return @divTrunc(self.sum, @as(i64, @intCast(self.total)));
+    }
+};
+
+//*****************************************************************************
+// first deadline for a read, aligned reads land on a multiple of their
+// interval, wall clock, plus align_offset_mstime
+fn first_deadline(read: *tty.tty_read_info_t, now: i64,
+        align_offset_mstime: i64) i64
+{
+    if (!read.align_to_clock or (read.interval_mstime < 1))
+    {
+        return now;
+    }
+    const since = now - align_offset_mstime;
+    const slot = std.math.divCeil(i64, since, read.interval_mstime)
+            catch return now;
+    return slot * read.interval_mstime + align_offset_mstime;
+}
+
+//*****************************************************************************
+// adaptive reads, poll at min_interval_mstime when the watched register
+// moves faster than rate_threshold or is within watch_band of
+// watch_threshold, relax toward max_interval_mstime when it is steady,
+// shrinking is immediate, relaxing is 25% per read
+pub fn adapt(read: *tty.tty_read_info_t, regs: []u16, now: i64) void
+{
+    const aadapt = read.adapt orelse return;
+    if (aadapt.watch_offset >= regs.len)
+    {
+        return;
+    }
+    const value = @as(f64, @floatFromInt(regs[aadapt.watch_offset])) /
+            aadapt.watch_scale;
+    var urgency: f64 = 0.0;
+    if (read.last_value) |alast_value|
+    {
+        const dt = now - read.last_value_mstime;
+        if ((dt > 0) and (aadapt.rate_threshold > 0.0))
+        {
+            const seconds = @as(f64, @floatFromInt(dt)) / 1000.0;
+            const rate = @abs(value - alast_value) / seconds;
+            urgency = @max(urgency, rate / aadapt.rate_threshold);
+        }
+    }
+    if (aadapt.watch_threshold) |awatch_threshold|
+    {
+        const distance = @abs(value - awatch_threshold);
+        if (distance <= aadapt.watch_band)
+        {
+            urgency = 1.0;
+        }
+        else if (aadapt.watch_band > 0.0)
+        {
+            // falls off linearly out to 4 bands away
+            const bands = distance / aadapt.watch_band;
+            urgency = @max(urgency, @max(0.0, (4.0 - bands) / 3.0));
+        }
+    }
+    urgency = @min(urgency, 1.0);
+    read.last_value = value;
+    read.last_value_mstime = now;
+    const min_mstime = aadapt.min_interval_mstime;
+    const max_mstime = @max(aadapt.max_interval_mstime, min_mstime);
+    const span: f64 = @floatFromInt(max_mstime - min_mstime);
+    const target: i64 = max_mstime - @as(i64, @intFromFloat(span * urgency));
+    if (target < read.interval_mstime)
+    {
+        read.interval_mstime = target;
+    }
+    else
+    {
+        const relaxed = read.interval_mstime +
+                @divTrunc(read.interval_mstime, 4);
+        read.interval_mstime = @min(target, relaxed);
+    }
+    read.interval_mstime = std.math.clamp(read.interval_mstime,
+            min_mstime, max_mstime);
+}
+
+//*****************************************************************************
+// move next_mstime forward one interval from the previous deadline, not
+// from when the read finished, so slow responses do not make the schedule
+// drift, slots already in the past are skipped and counted as missed
+pub fn advance(read: *tty.tty_read_info_t, now: i64) void
+{
+    const interval = @max(read.interval_mstime, 1);
+    read.next_mstime += interval;
+    if (read.next_mstime <= now)
+    {
+        const skip = @divTrunc(now - read.next_mstime, interval) + 1;
+        read.next_mstime += skip * interval;
+        read.missed += @intCast(skip);
+    }
+}
+
+//*****************************************************************************
+// binary min heap of read_list indexes, less decides the order
+fn heap_t(comptime less: fn (reads: []tty.tty_read_info_t,
+        a: usize, b: usize) bool) type
+{
+    return struct
+    {
+        items: std.ArrayListUnmanaged(usize) = .{},
+
+        const Self = @This();
+
+        //*********************************************************************
+        fn deinit(self: *Self, allocator: std.mem.Allocator) void
+        {
+            self.items.deinit(allocator);
+        }
+
+        //*********************************************************************
+        fn count(self: *Self) usize
+        {
+            return self.items.items.len;
+        }
+
+        //*********************************************************************
+        fn peek(self: *Self) ?usize
+        {
+            if (self.items.items.len < 1)
+            {
+                return null;
+            }
+            return self.items.items[0];
+        }
+
+        //*********************************************************************
+        fn push(self: *Self, allocator: std.mem.Allocator,
+                reads: []tty.tty_read_info_t, read_index: usize) !void
+        {
+            try self.items.append(allocator, read_index);
+            const heap = self.items.items;
+            var index = heap.len - 1;
+            while (index > 0)
+            {
+                const parent = (index - 1) / 2;
+                if (!less(reads, heap[index], heap[parent]))
+                {
+                    break;
+                }
+                std.mem.swap(usize, &heap[index], &heap[parent]);
+                index = parent;
+            }
+        }
+
+        //*********************************************************************
+        fn pop(self: *Self, reads: []tty.tty_read_info_t) ?usize
+        {
+            if (self.items.items.len < 1)
+            {
+                return null;
+            }
+            const rv = self.items.items[0];
+            const last_index = self.items.items.len - 1;
+            const last = self.items.items[last_index];
+            self.items.shrinkRetainingCapacity(last_index);
+            const heap = self.items.items;
+            if (heap.len < 1)
+            {
+                return rv;
+            }
+            heap[0] = last;
+            var index: usize = 0;
+            while (true)
+            {
+                const left = index * 2 + 1;
+                const right = left + 1;
+                var smallest = index;
+                if ((left < heap.len) and
+                        less(reads, heap[left], heap[smallest]))
+                {
+                    smallest = left;
+                }
+                if ((right < heap.len) and
+                        less(reads, heap[right], heap[smallest]))
+                {
+                    smallest = right;
+                }
+                if (smallest == index)
+                {
+                    break;
+                }
+                std.mem.swap(usize, &heap[index], &heap[smallest]);
+                index = smallest;
+            }
+            return rv;
+        }
+    };
+}
+
+//*****************************************************************************
+fn wait_less(reads: []tty.tty_read_info_t, a: usize, b: usize) bool
+{
+    const ra = &reads[a];
+    const rb = &reads[b];
+    if (ra.next_mstime != rb.next_mstime)
+    {
+        return ra.next_mstime < rb.next_mstime;
+    }
+    return ra.priority > rb.priority;
+}
+
+// a transaction that is due, a periodic read or a one shot job
+pub const entry_t = struct
+{
+    read_index: ?usize = null,
+    job: ?*tty.tty_job_t = null,
+    deadline: i64 = 0,
+    priority: u8 = 0,
+};
+
+//*****************************************************************************
+// true if a should go on the bus before b, higher priority first and
+// earliest deadline first within a priority, anything starve_mstime past
+// its deadline goes ahead of every priority so nothing waits forever
+fn entry_before(a: *const entry_t, b: *const entry_t, now: i64,
+        starve_mstime: i64) bool
+{
+    const a_starved = now - a.deadline >= starve_mstime;
+    const b_starved = now - b.deadline >= starve_mstime;
+    if (a_starved != b_starved)
+    {
+        return a_starved;
+    }
+    if (!a_starved and (a.priority != b.priority))
+    {
+        return a.priority > b.priority;
+    }
+    if (a.deadline != b.deadline)
+    {
+        return a.deadline < b.deadline;
+    }
+    return a.priority > b.priority;
+}
+
+// periodic reads wait in a heap ordered by due time, once due they join
+// the one shot jobs in the ready list, the next transaction is picked
+// from it by entry_before, the ready list is short so it is scanned
+pub const sched_t = struct
+{
+    allocator: std.mem.Allocator = undefined,
+    wait: heap_t(wait_less) = .{},
+    ready: std.ArrayListUnmanaged(entry_t) = .{},
+    started: bool = false,
+    starve_mstime: i64 = 10000,
+    max_depth: usize = 0, // most transactions ready at once
+
+    //*************************************************************************
+    pub fn init(self: *sched_t, allocator: std.mem.Allocator) void
+    {
+        self.* = .{.allocator = allocator};
+    }
+
+    //*************************************************************************
+    pub fn deinit(self: *sched_t) void
+    {
+        self.wait.deinit(self.allocator);
+        self.ready.deinit(self.allocator);
+    }
+
+    //*************************************************************************
+    // drop the periodic reads, jobs stay until take_job
+    pub fn clear(self: *sched_t) void
+    {
+        self.wait.items.clearRetainingCapacity();
+        var index = self.ready.items.len;
+        while (index > 0)
+        {
+            index -= 1;
+            if (self.ready.items[index].job == null)
+            {
+                _ = self.ready.swapRemove(index);
+            }
+        }
+        self.started = false;
+    }
+
+    //*************************************************************************
+    // schedule every read to be due at now or its first aligned slot,
+    // static reads already done are left out, so are reads on the bus,
+    // finishing puts them back
+    pub fn start(self: *sched_t, reads: []tty.tty_read_info_t,
+            now: i64, align_offset_mstime: i64) !void
+    {
+        self.clear();
+        for (reads, 0..) |*read, index|
+        {
+            if (read.static_valid or read.in_flight)
+            {
+                continue;
+            }
+            read.next_mstime = first_deadline(read, now, align_offset_mstime);
+            try self.wait.push(self.allocator, reads, index);
+        }
+        self.started = true;
+    }
+
+    //*************************************************************************
+    fn add_ready(self: *sched_t, entry: entry_t) !void
+    {
+        try self.ready.append(self.allocator, entry);
+        self.max_depth = @max(self.max_depth, self.ready.items.len);
+    }
+
+    //*************************************************************************
+    // move reads that are due at now to the ready list, a read is due by
+    // next_mstime plus its deadline_mstime, its interval if not set
+    pub fn release(self: *sched_t, reads: []tty.tty_read_info_t,
+            now: i64) !void
+    {
+        while (self.wait.peek()) |read_index|
+        {
+            const read = &reads[read_index];
+            if (read.next_mstime > now)
+            {
+                break;
+            }
+            _ = self.wait.pop(reads);
+            const relative = read.deadline_mstime orelse read.interval_mstime;
+            try self.add_ready(.{.read_index = read_index,
+                    .deadline = read.next_mstime + relative,
+                    .priority = read.priority});
+        }
+    }
+
+    //*************************************************************************
+    pub fn add_job(self: *sched_t, job: *tty.tty_job_t) !void
+    {
+        try self.add_ready(.{.job = job, .deadline = job.deadline,
+                .priority = job.priority});
+    }
+
+    //*************************************************************************
+    // remove and return any job, null if there are none
+    pub fn take_job(self: *sched_t) ?*tty.tty_job_t
+    {
+        for (self.ready.items, 0..) |*entry, index|
+        {
+            if (entry.job) |ajob|
+            {
+                _ = self.ready.swapRemove(index);
+                return ajob;
+            }
+        }
+        return null;
+    }
+
+    //*************************************************************************
+    // transactions ready to go on the bus
+    pub fn depth(self: *sched_t) usize
+    {
+        return self.ready.items.len;
+    }
+
+    //*************************************************************************
+    // transaction that goes next, null if none are due
+    pub fn next_ready(self: *sched_t, now: i64) ?entry_t
+    {
+        const items = self.ready.items;
+        if (items.len < 1)
+        {
+            return null;
+        }
+        var best: usize = 0;
+        for (1..items.len) |index|
+        {
+            if (entry_before(&items[index], &items[best], now,
+                    self.starve_mstime))
+            {
+                best = index;
+            }
+        }
+        return self.ready.swapRemove(best);
+    }
+
+    //*************************************************************************
+    // put a read back after setting its next_mstime
+    pub fn reschedule(self: *sched_t, reads: []tty.tty_read_info_t,
+            read_index: usize) !void
+    {
+        try self.wait.push(self.allocator, reads, read_index);
+    }
+
+    //*************************************************************************
+    // earliest time something will be ready, null if nothing is scheduled
+    pub fn next_mstime(self: *sched_t, reads: []tty.tty_read_info_t,
+            now: i64) ?i64
+    {
+        if (self.ready.items.len > 0)
+        {
+            return now;
+        }
+        if (self.wait.peek()) |read_index|
+        {
+            return reads[read_index].next_mstime;
+        }
+        return null;
+    }
+};
+
+//*****************************************************************************
+test "first_deadline aligns to the interval plus offset"
+{
+    var read: tty.tty_read_info_t = .{.interval_mstime = 1000};
+    try std.testing.expectEqual(@as(i64, 12345),
+            first_deadline(&read, 12345, 0));
+    read.align_to_clock = true;
+    try std.testing.expectEqual(@as(i64, 13000),
+            first_deadline(&read, 12345, 0));
+    try std.testing.expectEqual(@as(i64, 12000),
+            first_deadline(&read, 12000, 0));
+    try std.testing.expectEqual(@as(i64, 12250),
+            first_deadline(&read, 12100, 250));
+}
+
+//*****************************************************************************
+test "advance does not drift and counts skipped slots"
+{
+    var read: tty.tty_read_info_t = .{.interval_mstime = 1000,
+            .next_mstime = 5000};
+    // finished late but inside the next slot
+    advance(&read, 5900);
+    try std.testing.expectEqual(@as(i64, 6000), read.next_mstime);
+    try std.testing.expectEqual(@as(u64, 0), read.missed);
+    // 7000 and 8000 are gone
+    advance(&read, 8500);
+    try std.testing.expectEqual(@as(i64, 9000), read.next_mstime);
+    try std.testing.expectEqual(@as(u64, 2), read.missed);
+}
+
+//*****************************************************************************
+test "hist_t buckets"
+{
+    var hist: hist_t = .{};
+    hist.add(-3);
+    hist.add(0);
+    hist.add(1);
+    hist.add(5);
+    hist.add(1 << 40);
+    try std.testing.expectEqual(@as(u64, 2), hist.counts[0]);
+    try std.testing.expectEqual(@as(u64, 1), hist.counts[1]);
+    try std.testing.expectEqual(@as(u64, 1), hist.counts[3]);
+    try std.testing.expectEqual(@as(u64, 1),
+            hist.counts[g_hist_buckets - 1]);
+    try std.testing.expectEqual(@as(i64, 7), hist_t.bucket_max(3));
+    try std.testing.expectEqual(@as(u64, 5), hist.total);
+    try std.testing.expectEqual(@as(i64, 1 << 40), hist.max);
+}
+
+//*****************************************************************************
+test "adapt then advance, a shrink takes effect on the next deadline"
+{
+    var read: tty.tty_read_info_t = .{.interval_mstime = 60000,
+            .next_mstime = 100000,
+            .adapt = .{.min_interval_mstime = 1000,
+            .max_interval_mstime = 60000, .watch_threshold = 11.5,
+            .watch_band = 0.5}};
+    // read started at 100000, the watched register is inside the band
+    var regs = [_]u16{11};
+    adapt(&read, &regs, 100200);
+    try std.testing.expectEqual(@as(i64, 1000), read.interval_mstime);
+    advance(&read, 100200);
+    try std.testing.expectEqual(@as(i64, 101000), read.next_mstime);
+    try std.testing.expectEqual(@as(u64, 0), read.missed);
+    // steady and far from the threshold, relaxes 25% a read
+    regs[0] = 100;
+    adapt(&read, &regs, 101200);
+    try std.testing.expectEqual(@as(i64, 1250), read.interval_mstime);
+}
+
+//*****************************************************************************
+test "sched_t priority, then earliest deadline, starved first"
+{
+    var sched: sched_t = .{};
+    sched.init(std.testing.allocator);
+    defer sched.deinit();
+    var reads = [_]tty.tty_read_info_t{
+        .{.next_mstime = 1000, .interval_mstime = 1000}, // due by 2000
+        .{.next_mstime = 1000, .interval_mstime = 500}, // due by 1500
+        .{.next_mstime = 1200, .interval_mstime = 1000, .priority = 5},
+        .{.next_mstime = 5000, .interval_mstime = 1000},
+    };
+    for (0..reads.len) |index|
+    {
+        try sched.reschedule(&reads, index);
+    }
+    var request: tty.tty_job_t = .{.priority = 255, .deadline = 2300};
+    var write: tty.tty_job_t = .{.deadline = 1400};
+    try sched.release(&reads, 1300);
+    try sched.add_job(&request);
+    try sched.add_job(&write);
+    try std.testing.expectEqual(@as(usize, 5), sched.depth());
+    try std.testing.expectEqual(&request, sched.next_ready(1300).?.job.?);
+    try std.testing.expectEqual(@as(?usize, 2),
+            sched.next_ready(1300).?.read_index);
+    try std.testing.expectEqual(&write, sched.next_ready(1300).?.job.?);
+    try std.testing.expectEqual(@as(?usize, 1),
+            sched.next_ready(1300).?.read_index);
+    try std.testing.expectEqual(@as(?usize, 0),
+            sched.next_ready(1300).?.read_index);
+    try std.testing.expect(sched.next_ready(1300) == null);
+    // read 3 is still waiting
+    try std.testing.expectEqual(@as(?i64, 5000),
+            sched.next_mstime(&reads, 1300));
+    // a low priority read starve_mstime past its deadline beats a
+    // request
+    sched.starve_mstime = 10000;
+    reads[0].next_mstime = 0;
+    try sched.reschedule(&reads, 0);
+    try sched.release(&reads, 10999);
+    request.deadline = 12000;
+    try sched.add_job(&request);
+    const read_entry: entry_t = .{.read_index = 0, .deadline = 1000};
+    const job_entry: entry_t = .{.job = &request, .deadline = 12000,
+            .priority = 255};
+    try std.testing.expect(!entry_before(&read_entry, &job_entry, 10999,
+            sched.starve_mstime));
+    try std.testing.expect(entry_before(&read_entry, &job_entry, 11000,
+            sched.starve_mstime));
+    try std.testing.expectEqual(@as(?usize, 0),
+            sched.next_ready(11000).?.read_index);
+    try std.testing.expectEqual(&request, sched.next_ready(11000).?.job.?);
+}
@@ -0,0 +1,239 @@
+const std = @import("std");
+
+// response latency samples kept for the percentile
+const g_latency_samples: usize = 32;
+// samples needed before the measured timeout replaces the configured one
+const g_min_samples: usize = 4;
+
+// response latency of one slave, smoothed like tcp rtt, srtt and rttvar
+// with gains 1/8 and 1/4, plus the 95th percentile of the last samples
+pub const latency_t = struct
+{
+    srtt_us: i64 = 0,
+    rttvar_us: i64 = 0,
+    samples: [g_latency_samples]i64 = .{0} ** g_latency_samples,
+    sample_count: usize = 0, // total, only the last g_latency_samples kept
+    timeouts: u64 = 0,
+
+    //*************************************************************************
+    pub fn add(self: *latency_t, us: i64) void
+    {
+        if (self.sample_count < 1)
+        {
+            self.srtt_us = us;
+            self.rttvar_us = @divTrunc(us, 2);
+        }
+        else
+        {
+            const err = us - self.srtt_us;
+            self.srtt_us += @divTrunc(err, 8);
+            self.rttvar_us += @divTrunc(@as(i64, @intCast(@abs(err))) -
+                    self.rttvar_us, 4);
+        }
+        self.samples[self.sample_count % g_latency_samples] = us;
+        self.sample_count += 1;
+    }
+
+    //*************************************************************************
+    pub fn p95(self: *const latency_t) i64
+    {
+        const count = @min(self.sample_count, g_latency_samples);
+        if (count < 1)
+        {
+            return 0;
+        }
+        var sorted: [g_latency_samples]i64 = undefined;
+        std.mem.copyForwards(i64, &sorted, self.samples[0..count]);
+        std.mem.sort(i64, sorted[0..count], {}, std.sort.asc(i64));
+        return sorted[(count * 95 + 99) / 100 - 1];
+    }
+
+    //*************************************************************************
+    // response timeout, the larger of srtt + 4 rttvar and 1.5 times the
+    // 95th percentile, configured ceiling until there are enough samples
+    pub fn timeout_us(self: *const latency_t, floor_us: i64,
+            ceiling_us: i64) i64
+    {
+        if (self.sample_count < g_min_samples)
+        {
+            return ceiling_us;
+        }
+        const p = self.p95();
+        const rv = @max(self.srtt_us + 4 * self.rttvar_us, p + @divTrunc(p, 2));
+        return std.math.clamp(rv, floor_us, @max(floor_us, ceiling_us));
+    }
+
+    //*************************************************************************
+    // quiet time after a transaction with this slave, about one response
+    // time, slaves that answer fast get back on the bus fast
+    pub fn gap_mstime(self: *const latency_t, floor_mstime: i64,
+            ceiling_mstime: i64) i64
+    {
+        if (self.sample_count < g_min_samples)
+        {
+            return ceiling_mstime;
+        }
+        const srtt_mstime = @divTrunc(self.srtt_us + 999, 1000);
+        return std.math.clamp(srtt_mstime, floor_mstime,
+                @max(floor_mstime, ceiling_mstime));
+    }
+};
+
+pub const health_state_t = enum(u16)
+{
+    Ok = 0,
+    Failing = 1, // timeouts in a row, not yet breaker_timeouts
+    Open = 2, // skipped until open_until
+    Probing = 3, // one read let through to see if it is back
+};
+
+// circuit breaker for a slave that stops answering, after
+// breaker_timeouts timeouts in a row its reads are skipped, every
+// backoff one read probes it, the backoff doubles each failed probe
+pub const health_t = struct
+{
+    state: health_state_t = .Ok,
+    timeouts_in_row: u32 = 0,
+    backoff_mstime: i64 = 0,
+    open_until: i64 = 0,
+    failures: u64 = 0, // all failed reads
+    skipped: u64 = 0, // reads not done because the breaker was open
+
+    //*************************************************************************
+    // true if a read of this slave can go on the bus now
+    pub fn allow(self: *health_t, now: i64) bool
+    {
+        switch (self.state)
+        {
+            .Ok, .Failing => return true,
+            .Open =>
+            {
+                if (now >= self.open_until)
+                {
+                    self.state = .Probing;
+                    return true;
+                }
+            },
+            .Probing => {},
+        }
+        self.skipped += 1;
+        return false;
+    }
+
+    //*************************************************************************
+    // the slave answered, even with an error, returns true if the state
+    // changed
+    pub fn on_answer(self: *health_t) bool
+    {
+        const old_state = self.state;
+        self.state = .Ok;
+        self.timeouts_in_row = 0;
+        self.backoff_mstime = 0;
+        return old_state != self.state;
+    }
+
+    //*************************************************************************
+    // returns true if the state changed
+    pub fn on_timeout(self: *health_t, now: i64, breaker_timeouts: u32,
+            min_mstime: i64, max_mstime: i64) bool
+    {
+        const old_state = self.state;
+        self.timeouts_in_row += 1;
+        if ((self.state == .Probing) or
+                (self.timeouts_in_row >= @max(breaker_timeouts, 1)))
+        {
+            self.backoff_mstime = if (self.backoff_mstime < 1) min_mstime
+                    else @min(self.backoff_mstime * 2, max_mstime);
+            self.open_until = now + self.backoff_mstime;
+            self.state = .Open;
+        }
+        else
+        {
+            self.state = .Failing;
+        }
+        return old_state != self.state;
+    }
+
+    //*************************************************************************
+    // the probe was lost with the link, let the next one go
+    pub fn reset_probe(self: *health_t) void
+    {
+        if (self.state == .Probing)
+        {
+            self.state = .Open;
+        }
+    }
+};
+
+//*****************************************************************************
+test "latency_t srtt and rttvar"
+{
+    var latency: latency_t = .{};
+    latency.add(8000);
+    try std.testing.expectEqual(@as(i64, 8000), latency.srtt_us);
+    try std.testing.expectEqual(@as(i64, 4000), latency.rttvar_us);
+    latency.add(16000);
+    try std.testing.expectEqual(@as(i64, 9000), latency.srtt_us);
+    try std.testing.expectEqual(@as(i64, 5000), latency.rttvar_us);
+}
+
+//*****************************************************************************
+test "latency_t p95 of the last samples and timeout_us"
+{
+    var latency: latency_t = .{};
+    try std.testing.expectEqual(@as(i64, 0), latency.p95());
+    latency.add(1000);
+    // not enough samples, the configured ceiling
+    try std.testing.expectEqual(@as(i64, 500000),
+            latency.timeout_us(20000, 500000));
+    var us: i64 = 2000;
+    while (us <= 40000) : (us += 1000)
+    {
+        latency.add(us);
+    }
+    // 9000 to 40000 are kept, 95% of 32 is the 31st
+    try std.testing.expectEqual(@as(i64, 39000), latency.p95());
+    const timeout = latency.timeout_us(20000, 500000);
+    try std.testing.expect(timeout >= 39000 + 19500);
+    try std.testing.expectEqual(@as(i64, 30000),
+            latency.timeout_us(20000, 30000));
+}
+
+//*****************************************************************************
+test "health_t breaker states and backoff"
+{
+    var health: health_t = .{};
+    // 3 timeouts in a row open it for 5 s
+    try std.testing.expect(health.on_timeout(0, 3, 5000, 12000));
+    try std.testing.expectEqual(health_state_t.Failing, health.state);
+    try std.testing.expect(health.allow(50));
+    try std.testing.expect(!health.on_timeout(100, 3, 5000, 12000));
+    try std.testing.expect(health.on_timeout(200, 3, 5000, 12000));
+    try std.testing.expectEqual(health_state_t.Open, health.state);
+    try std.testing.expect(!health.allow(5199));
+    // one probe, then skipped while it is out
+    try std.testing.expect(health.allow(5200));
+    try std.testing.expectEqual(health_state_t.Probing, health.state);
+    try std.testing.expect(!health.allow(5250));
+    try std.testing.expectEqual(@as(u64, 2), health.skipped);
+    // failed probes double the backoff up to the max
+    try std.testing.expect(health.on_timeout(5300, 3, 5000, 12000));
+    try std.testing.expectEqual(@as(i64, 10000), health.backoff_mstime);
+    try std.testing.expect(!health.allow(15299));
+    try std.testing.expect(health.allow(15300));
+    _ = health.on_timeout(15400, 3, 5000, 12000);
+    try std.testing.expectEqual(@as(i64, 12000), health.backoff_mstime);
+    try std.testing.expectEqual(@as(i64, 27400), health.open_until);
+    // a probe lost with the link, the next one goes right away
+    try std.testing.expect(health.allow(27400));
+    health.reset_probe();
+    try std.testing.expectEqual(health_state_t.Open, health.state);
+    try std.testing.expect(health.allow(27401));
+    // it answered, back to Ok and the count starts over
+    try std.testing.expect(health.on_answer());
+    try std.testing.expect(!health.on_answer());
+    try std.testing.expectEqual(@as(i64, 0), health.backoff_mstime);
+    _ = health.on_timeout(30000, 3, 5000, 12000);
+    try std.testing.expectEqual(health_state_t.Failing, health.state);
+    try std.testing.expect(health.allow(30001));
+}
@@ -0,0 +1,357 @@
+const std = @import("std");
+const builtin = @import("builtin");
+const log = @import("log");
+const hexdump = @import("hexdump");
+const rtu = @import("tty_rtu.zig");
+const posix = std.posix;
+
+// a read another master did, its request and the slave's answer
+pub const pair_t = struct
+{
+    id: u8 = 0,
+    function: u8 = 0, // 0x03, 0x04 or 0x17
+    address: u16 = 0,
+    count: u16 = 0,
+    pdu: []const u8 = &.{}, // response pdu, valid until the next call
+};
+
+const request_t = struct
+{
+    id: u8 = 0,
+    function: u8 = 0,
+    address: u16 = 0, // read address, 0x03, 0x04 and 0x17 only
+    count: u16 = 0,
+};
+
+// listen only rtu, frames are found by length from the function code and
+// checked by crc, a request followed by the answer from the same slave
+// makes a pair, after frame_gap_us of silence any partial frame is
+// dropped, bytes that do not start a good frame are skipped one at a time
+pub const sniff_t = struct
+{
+    debug: bool = false,
+    frame_gap_us: i64 = 20000,
+    rx: [rtu.g_max_adu * 2]u8 = undefined,
+    rx_len: usize = 0,
+    last_byte_us: i64 = 0,
+    request: ?request_t = null, // waiting for its answer
+    pair_pdu: [rtu.g_max_adu]u8 = undefined,
+    // stats
+    frames: u64 = 0,
+    pairs: u64 = 0,
+    skipped_bytes: u64 = 0,
+    dropped_partial: u64 = 0,
+
+    //*************************************************************************
+    pub fn init(self: *sniff_t, frame_gap_us: i64, debug: bool) void
+    {
+        self.* = .{.frame_gap_us = frame_gap_us, .debug = debug};
+    }
+
+    //*************************************************************************
+    pub fn on_readable(self: *sniff_t, fd: i32, now_us: i64) !void
+    {
+        while (true)
+        {
+            const in_slice = self.rx[self.rx_len..];
+            if (in_slice.len < 1)
+            {
+                // full, next_pair takes the frames in here and the poll
+                // comes back for the rest
+                return;
+            }
+            const read = posix.read(fd, in_slice) catch |err|
+            {
+                if (err == error.WouldBlock)
+                {
+                    return;
+                }
+                return err;
+            };
+            if (read < 1)
+            {
+                return;
+            }
+            self.rx_len += read;
+            self.last_byte_us = now_us;
+        }
+    }
+
+    //*************************************************************************
+    // milliseconds until check() has something to do, -1 for never
+    pub fn timeout_ms(self: *sniff_t, now_us: i64) i32
+    {
+        if (self.rx_len < 1)
+        {
+            return -1;
+        }
+        const rv = @divTrunc(self.last_byte_us + self.frame_gap_us -
+                now_us + 999, 1000);
+        return @intCast(std.math.clamp(rv, 0, 60000));
+    }
+
+    //*************************************************************************
+    // run the timer, call on every loop after next_pair returns null
+    pub fn check(self: *sniff_t, now_us: i64) void
+    {
+        if ((self.rx_len > 0) and
+                (now_us >= self.last_byte_us + self.frame_gap_us))
+        {
+            // the line went quiet in the middle of a frame
+            self.dropped_partial += 1;
+            self.rx_len = 0;
+            self.request = null;
+        }
+    }
+
+    //*************************************************************************
+    // the next read seen on the wire, null when more bytes are needed
+    pub fn next_pair(self: *sniff_t) !?pair_t
+    {
+        while (self.rx_len >= 4)
+        {
+            const data = self.rx[0..self.rx_len];
+            const rsp_len = rtu.expected_len(data);
+            const req_len = request_len(data);
+            // an answer is only looked for right after a request
+            var want_rsp = false;
+            if (self.request) |arequest|
+            {
+                want_rsp = data[0] == arequest.id;
+            }
+            var need_more = false;
+            if (want_rsp)
+            {
+                if (frame_ok(data, rsp_len, &need_more))
+                {
+                    const pair = try self.take_response(rsp_len.?);
+                    if (pair != null)
+                    {
+                        return pair;
+                    }
+                    continue;
+                }
+            }
+            if (frame_ok(data, req_len, &need_more))
+            {
+                try self.take_request(req_len.?);
+                continue;
+            }
+            if (!want_rsp and frame_ok(data, rsp_len, &need_more))
+            {
+                // an answer to a request we missed
+                try self.consume(rsp_len.?);
+                continue;
+            }
+            if (need_more)
+            {
+                return null;
+            }
+            self.skipped_bytes += 1;
+            self.consume_bytes(1);
+        }
+        return null;
+    }
+
+    //*************************************************************************
+    fn take_request(self: *sniff_t, len: usize) !void
+    {
+        const frame = self.rx[0..len];
+        var request: request_t = .{.id = frame[0], .function = frame[1]};
+        switch (request.function)
+        {
+            0x03, 0x04, 0x17 =>
+            {
+                request.address = std.mem.readInt(u16, frame[2..4], .big);
+                request.count = std.mem.readInt(u16, frame[4..6], .big);
+            },
+            else => {},
+        }
+        // broadcasts get no answer
+        self.request = if (request.id == 0) null else request;
+        try self.consume(len);
+    }
+
+    //*************************************************************************
+    fn take_response(self: *sniff_t, len: usize) !?pair_t
+    {
+        const request = self.request.?;
+        self.request = null;
+        const frame = self.rx[0..len];
+        var rv: ?pair_t = null;
+        if ((frame[1] == request.function) and (request.count > 0))
+        {
+            const pdu_len = len - 3;
+            std.mem.copyForwards(u8, &self.pair_pdu, frame[1..][0..pdu_len]);
+            rv = .{.id = request.id, .function = request.function,
+                    .address = request.address, .count = request.count,
+                    .pdu = self.pair_pdu[0..pdu_len]};
+            self.pairs += 1;
+        }
+        try self.consume(len);
+        return rv;
+    }
+
+    //*************************************************************************
+    fn consume(self: *sniff_t, len: usize) !void
+    {
+        self.frames += 1;
+        if (self.debug)
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "sniffed {} bytes", .{len});
+            try hexdump.printHexDump(0, self.rx[0..len]);
+        }
+        self.consume_bytes(len);
+    }
+
+    //*************************************************************************
+    fn consume_bytes(self: *sniff_t, len: usize) void
+    {
+        std.mem.copyForwards(u8, &self.rx, self.rx[len..self.rx_len]);
+        self.rx_len -= len;
+    }
+};
+
+//*****************************************************************************
+// total length of the rtu request frame in data, null if it can not be
+// known yet or the function is not one we decode
+fn request_len(data: []const u8) ?usize
+{
+    if (data.len < 2)
+    {
+        return null;
+    }
+    switch (data[1])
+    {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06 => return 8,
+        0x0F, 0x10 =>
+        {
+            // id, function, address, count, byte count, data, crc
+            if (data.len < 7)
+            {
+                return null;
+            }
+            return 9 + @as(usize, data[6]);
+        },
+        0x17 =>
+        {
+            // id, function, read address, count, write address, count,
+            // byte count, data, crc
+            if (data.len < 11)
+            {
+                return null;
+            }
+            return 13 + @as(usize, data[10]);
+        },
+        else => return null,
+    }
+}
+
+//*****************************************************************************
+// true if data starts with a frame of len bytes and a good crc, sets
+// need_more if the frame is not all in yet
+fn frame_ok(data: []const u8, len: ?usize, need_more: *bool) bool
+{
+    const alen = len orelse return false;
+    if (alen < 4)
+    {
+        return false;
+    }
+    if (data.len < alen)
+    {
+        need_more.* = true;
+        return false;
+    }
+    const crc = std.mem.readInt(u16, data[alen - 2..][0..2], .little);
+    return crc == rtu.crc16(data[0..alen - 2]);
+}
+
+// test helpers, only in zig build test
+const test_util = if (builtin.is_test) struct
+{
+    //*************************************************************************
+    // bytes into rx as if read from the tty, a good crc after them if
+    // with_crc
+    fn push(self: *sniff_t, bytes: []const u8, with_crc: bool) void
+    {
+        const start = self.rx_len;
+        std.mem.copyForwards(u8, self.rx[start..], bytes);
+        self.rx_len += bytes.len;
+        if (with_crc)
+        {
+            std.mem.writeInt(u16, self.rx[self.rx_len..][0..2],
+                    rtu.crc16(self.rx[start..self.rx_len]), .little);
+            self.rx_len += 2;
+        }
+    }
+} else struct {};
+
+//*****************************************************************************
+test "sniff_t splits frames and pairs a read with its answer"
+{
+    var sniff: sniff_t = .{};
+    // line noise, a read of 2 registers at 0x10, half of the answer
+    test_util.push(&sniff, &.{0xFF}, false);
+    test_util.push(&sniff, &.{0x01, 0x03, 0x00, 0x10, 0x00, 0x02}, true);
+    var rsp: [9]u8 = .{0x01, 0x03, 0x04, 0x00, 0x0A, 0x00, 0x0B, 0, 0};
+    std.mem.writeInt(u16, rsp[7..9], rtu.crc16(rsp[0..7]), .little);
+    test_util.push(&sniff, rsp[0..4], false);
+    try std.testing.expect((try sniff.next_pair()) == null);
+    try std.testing.expectEqual(@as(u64, 1), sniff.skipped_bytes);
+    try std.testing.expectEqual(@as(u64, 1), sniff.frames);
+    // the rest of the answer
+    test_util.push(&sniff, rsp[4..], false);
+    const pair = (try sniff.next_pair()).?;
+    try std.testing.expectEqual(@as(u8, 1), pair.id);
+    try std.testing.expectEqual(@as(u8, 0x03), pair.function);
+    try std.testing.expectEqual(@as(u16, 0x10), pair.address);
+    try std.testing.expectEqual(@as(u16, 2), pair.count);
+    var regs: [2]u16 = undefined;
+    try rtu.regs_from_pdu(pair.pdu, &regs);
+    try std.testing.expectEqual(@as(u16, 0x0A), regs[0]);
+    try std.testing.expectEqual(@as(u16, 0x0B), regs[1]);
+    try std.testing.expectEqual(@as(usize, 0), sniff.rx_len);
+    try std.testing.expectEqual(@as(u64, 1), sniff.pairs);
+}
+
+//*****************************************************************************
+test "sniff_t drops a partial frame after the gap"
+{
+    var sniff: sniff_t = .{};
+    sniff.last_byte_us = 1000;
+    test_util.push(&sniff, &.{0x01, 0x03, 0x00, 0x10, 0x00}, false);
+    try std.testing.expect((try sniff.next_pair()) == null);
+    sniff.check(1000 + sniff.frame_gap_us - 1);
+    try std.testing.expectEqual(@as(usize, 5), sniff.rx_len);
+    sniff.check(1000 + sniff.frame_gap_us);
+    try std.testing.expectEqual(@as(usize, 0), sniff.rx_len);
+    try std.testing.expectEqual(@as(u64, 1), sniff.dropped_partial);
+}
+
+//*****************************************************************************
+test "sniff_t keeps the frames in a full buffer"
+{
+    const fds = try posix.pipe2(.{.NONBLOCK = true});
+    defer posix.close(fds[0]);
+    defer posix.close(fds[1]);
+    // more 0x06 writes than rx holds
+    var frame: [8]u8 = .{0x01, 0x06, 0x00, 0x10, 0x00, 0x01, 0, 0};
+    std.mem.writeInt(u16, frame[6..8], rtu.crc16(frame[0..6]), .little);
+    const frame_count = 75;
+    var index: usize = 0;
+    while (index < frame_count) : (index += 1)
+    {
+        _ = try posix.write(fds[1], &frame);
+    }
+    var sniff: sniff_t = .{};
+    try sniff.on_readable(fds[0], 0);
+    try std.testing.expectEqual(sniff.rx.len, sniff.rx_len);
+    while (try sniff.next_pair()) |_| {}
+    try sniff.on_readable(fds[0], 0);
+    while (try sniff.next_pair()) |_| {}
+    try std.testing.expectEqual(@as(u64, frame_count), sniff.frames);
+    try std.testing.expectEqual(@as(u64, 0), sniff.skipped_bytes);
+    try std.testing.expectEqual(@as(u64, 0), sniff.dropped_partial);
+    try std.testing.expectEqual(@as(usize, 0), sniff.rx_len);
+}
@@ -0,0 +1,573 @@
+const std = @import("std");
+const builtin = @import("builtin");
+const log = @import("log");
+const hexdump = @import("hexdump");
+const rtu = @import("tty_rtu.zig");
+const posix = std.posix;
+
+pub const TcpError = error
+{
+    TcpBusy,
+    TcpFrameTooBig,
+    TcpClosed,
+    TcpTimeout,
+    TcpCrcError,
+    TcpBadResponse,
+    TcpException,
+};
+
+// most requests in flight on one connection
+pub const g_max_inflight: usize = 16;
+// mbap header, transaction id, protocol id, length, unit id
+const g_mbap_bytes: usize = 7;
+// largest frame either way, mbap + pdu(253), bigger than an rtu adu
+const g_max_frame: usize = g_mbap_bytes + 253;
+
+pub const tcp_slot_t = struct // one for each request in flight
+{
+    used: bool = false,
+    done: bool = false,
+    tid: u16 = 0,
+    slave: u8 = 0,
+    function: u8 = 0,
+    key: usize = 0, // owner's id for the request
+    sent_us: i64 = 0,
+    response_us: i64 = 0, // tcp_t.response_us when started
+    err: ?TcpError = null, // result once done, null is ok
+    rx: [g_max_frame]u8 = undefined,
+    rx_len: usize = 0,
+
+    //*************************************************************************
+    // response pdu, function code and data, valid when done without err
+    pub fn pdu(self: *tcp_slot_t) []const u8
+    {
+        return self.rx[0..self.rx_len];
+    }
+};
+
+// modbus tcp, requests are matched to responses by transaction id so
+// several can be in flight, rtu_framing is rtu frames with crc over a
+// tcp gateway, no transaction id so only one at a time, every call is
+// non blocking, the owner polls fd for poll_events() and calls check()
+// on every loop
+pub const tcp_t = struct
+{
+    fd: i32 = -1,
+    rtu_framing: bool = false,
+    debug: bool = false,
+    max_inflight: usize = 1,
+    response_us: i64 = 500000, // for the next start
+    next_tid: u16 = 0,
+    slots: [g_max_inflight]tcp_slot_t = [_]tcp_slot_t{.{}} ** g_max_inflight,
+    tx: [g_max_inflight * g_max_frame]u8 = undefined,
+    tx_len: usize = 0,
+    tx_sent: usize = 0,
+    rx: [g_max_inflight * g_max_frame]u8 = undefined,
+    rx_len: usize = 0,
+
+    //*************************************************************************
+    pub fn open(self: *tcp_t, allocator: std.mem.Allocator,
+            host: []const u8, port: u16, rtu_framing: bool,
+            max_inflight: usize) !void
+    {
+        self.* = .{.rtu_framing = rtu_framing};
+        self.max_inflight = if (rtu_framing) 1 else
+                std.math.clamp(max_inflight, 1, g_max_inflight);
+        // name lookup and connect block this bus thread, up to the
+        // kernel connect timeout on a dead gateway, the other buses and
+        // the main thread go on, jobs for this bus wait and then fail
+        // with BusDown
+        const stream = try std.net.tcpConnectToHost(allocator, host, port);
+        self.fd = stream.handle;
+        errdefer self.close();
+        const flags = try posix.fcntl(self.fd, posix.F.GETFL, 0);
+        _ = try posix.fcntl(self.fd, posix.F.SETFL,
+                flags | @as(usize, 1 << @bitOffsetOf(posix.O, "NONBLOCK")));
+        const one: c_int = 1;
+        try posix.setsockopt(self.fd, posix.IPPROTO.TCP, posix.TCP.NODELAY,
+                std.mem.asBytes(&one));
+    }
+
+    //*************************************************************************
+    pub fn close(self: *tcp_t) void
+    {
+        if (self.fd != -1)
+        {
+            posix.close(self.fd);
+            self.fd = -1;
+        }
+        for (&self.slots) |*slot|
+        {
+            slot.* = .{};
+        }
+        self.tx_len = 0;
+        self.tx_sent = 0;
+        self.rx_len = 0;
+    }
+
+    //*************************************************************************
+    fn inflight(self: *tcp_t) usize
+    {
+        var rv: usize = 0;
+        for (&self.slots) |*slot|
+        {
+            if (slot.used)
+            {
+                rv += 1;
+            }
+        }
+        return rv;
+    }
+
+    //*************************************************************************
+    pub fn can_start(self: *tcp_t) bool
+    {
+        return (self.fd != -1) and (self.inflight() < self.max_inflight);
+    }
+
+    //*************************************************************************
+    // queue a request, pdu is function code and data, key comes back in
+    // the slot from next_done
+    pub fn start(self: *tcp_t, slave: u8, pdu: []const u8, key: usize,
+            now_us: i64) !void
+    {
+        if (!self.can_start())
+        {
+            return TcpError.TcpBusy;
+        }
+        const frame_len = if (self.rtu_framing) pdu.len + 3 else
+                pdu.len + g_mbap_bytes;
+        if ((pdu.len < 1) or (frame_len > g_max_frame) or
+                (self.tx_len + frame_len > self.tx.len))
+        {
+            return TcpError.TcpFrameTooBig;
+        }
+        var slot: *tcp_slot_t = undefined;
+        for (&self.slots) |*aslot|
+        {
+            if (!aslot.used)
+            {
+                slot = aslot;
+                break;
+            }
+        }
+        const tid = self.next_tid;
+        self.next_tid +%= 1;
+        slot.* = .{.used = true, .tid = tid, .slave = slave,
+                .function = pdu[0], .key = key, .sent_us = now_us,
+                .response_us = self.response_us};
+        const frame = self.tx[self.tx_len..][0..frame_len];
+        if (self.rtu_framing)
+        {
+            frame[0] = slave;
+            std.mem.copyForwards(u8, frame[1..], pdu);
+            const crc = rtu.crc16(frame[0..pdu.len + 1]);
+            std.mem.writeInt(u16, frame[pdu.len + 1..][0..2], crc, .little);
+        }
+        else
+        {
+            std.mem.writeInt(u16, frame[0..2], tid, .big);
+            std.mem.writeInt(u16, frame[2..4], 0, .big);
+            std.mem.writeInt(u16, frame[4..6], @intCast(pdu.len + 1), .big);
+            frame[6] = slave;
+            std.mem.copyForwards(u8, frame[g_mbap_bytes..], pdu);
+        }
+        if (self.debug)
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "tx {} bytes tid {}", .{frame_len, tid});
+            try hexdump.printHexDump(0, frame);
+        }
+        self.tx_len += frame_len;
+        try self.write_some();
+    }
+
+    //*************************************************************************
+    pub fn poll_events(self: *tcp_t) i16
+    {
+        var events: i16 = posix.POLL.IN;
+        if (self.tx_sent < self.tx_len)
+        {
+            events |= posix.POLL.OUT;
+        }
+        return events;
+    }
+
+    //*************************************************************************
+    // milliseconds until check() has something to do, -1 for never
+    pub fn timeout_ms(self: *tcp_t, now_us: i64) i32
+    {
+        var due_us: ?i64 = null;
+        for (&self.slots) |*slot|
+        {
+            if (slot.used and !slot.done)
+            {
+                const slot_due_us = slot.sent_us + slot.response_us;
+                due_us = if (due_us) |adue_us| @min(adue_us, slot_due_us)
+                        else slot_due_us;
+            }
+        }
+        const due = due_us orelse return -1;
+        const rv = @divTrunc(due - now_us + 999, 1000);
+        return @intCast(std.math.clamp(rv, 0, 60000));
+    }
+
+    //*************************************************************************
+    fn write_some(self: *tcp_t) !void
+    {
+        const out_slice = self.tx[self.tx_sent..self.tx_len];
+        if (out_slice.len < 1)
+        {
+            return;
+        }
+        const sent = posix.send(self.fd, out_slice, 0) catch |err|
+        {
+            if (err == error.WouldBlock)
+            {
+                return;
+            }
+            return err;
+        };
+        self.tx_sent += sent;
+        if (self.tx_sent >= self.tx_len)
+        {
+            self.tx_sent = 0;
+            self.tx_len = 0;
+        }
+    }
+
+    //*************************************************************************
+    pub fn on_writable(self: *tcp_t) !void
+    {
+        try self.write_some();
+    }
+
+    //*************************************************************************
+    fn finish(self: *tcp_t, slot: *tcp_slot_t, response: []const u8,
+            err: ?TcpError) !void
+    {
+        std.mem.copyForwards(u8, &slot.rx, response);
+        slot.rx_len = response.len;
+        slot.err = err;
+        slot.done = true;
+        if ((err == null) and ((response.len < 1) or
+                ((response[0] & 0x7F) != slot.function)))
+        {
+            slot.err = TcpError.TcpBadResponse;
+        }
+        else if ((err == null) and ((response[0] & 0x80) != 0))
+        {
+            slot.err = TcpError.TcpException;
+        }
+        if (self.debug)
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "rx {} bytes tid {}", .{response.len, slot.tid});
+            try hexdump.printHexDump(0, response);
+        }
+    }
+
+    //*************************************************************************
+    // slot waiting for a response with tid, null if it timed out already
+    fn get_slot(self: *tcp_t, tid: u16) ?*tcp_slot_t
+    {
+        for (&self.slots) |*slot|
+        {
+            if (slot.used and !slot.done and
+                    (self.rtu_framing or (slot.tid == tid)))
+            {
+                return slot;
+            }
+        }
+        return null;
+    }
+
+    //*************************************************************************
+    // length of the first complete frame in rx, null if more is needed
+    fn rx_frame_len(self: *tcp_t) !?usize
+    {
+        const data = self.rx[0..self.rx_len];
+        if (self.rtu_framing)
+        {
+            const len = rtu.expected_len(data) orelse
+            {
+                if (data.len >= 3)
+                {
+                    // function with no known size, the stream is lost
+                    return TcpError.TcpBadResponse;
+                }
+                return null; // reads need their byte count
+            };
+            return if (data.len >= len) len else null;
+        }
+        if (data.len < g_mbap_bytes)
+        {
+            return null;
+        }
+        const len = std.mem.readInt(u16, data[4..6], .big);
+        if ((len < 2) or (len + 6 > g_max_frame))
+        {
+            return TcpError.TcpBadResponse;
+        }
+        return if (data.len >= len + 6) len + 6 else null;
+    }
+
+    //*************************************************************************
+    fn check_frames(self: *tcp_t) !void
+    {
+        while (try self.rx_frame_len()) |len|
+        {
+            const frame = self.rx[0..len];
+            if (self.rtu_framing)
+            {
+                if (self.get_slot(0)) |slot|
+                {
+                    const crc = std.mem.readInt(u16, frame[len - 2..][0..2],
+                            .little);
+                    if (crc != rtu.crc16(frame[0..len - 2]))
+                    {
+                        try self.finish(slot, frame[1..len - 2],
+                                TcpError.TcpCrcError);
+                    }
+                    else if (frame[0] != slot.slave)
+                    {
+                        try self.finish(slot, frame[1..len - 2],
+                                TcpError.TcpBadResponse);
+                    }
+                    else
+                    {
+                        try self.finish(slot, frame[1..len - 2], null);
+                    }
+                }
+            }
+            else
+            {
+                const tid = std.mem.readInt(u16, frame[0..2], .big);
+                // no slot means it timed out already, drop it
+                if (self.get_slot(tid)) |slot|
+                {
+                    try self.finish(slot, frame[g_mbap_bytes..],
+                            if (frame[6] == slot.slave) null else
+                            TcpError.TcpBadResponse);
+                }
+            }
+            std.mem.copyForwards(u8, &self.rx, self.rx[len..self.rx_len]);
+            self.rx_len -= len;
+        }
+    }
+
+    //*************************************************************************
+    pub fn on_readable(self: *tcp_t) !void
+    {
+        while (true)
+        {
+            const in_slice = self.rx[self.rx_len..];
+            if (in_slice.len < 1)
+            {
+                return TcpError.TcpBadResponse;
+            }
+            const read = posix.recv(self.fd, in_slice, 0) catch |err|
+            {
+                if (err == error.WouldBlock)
+                {
+                    return;
+                }
+                return err;
+            };
+            if (read < 1)
+            {
+                return TcpError.TcpClosed;
+            }
+            self.rx_len += read;
+            try self.check_frames();
+        }
+    }
+
+    //*************************************************************************
+    // run the timers, call on every loop
+    pub fn check(self: *tcp_t, now_us: i64) !void
+    {
+        for (&self.slots) |*slot|
+        {
+            if (slot.used and !slot.done and
+                    (now_us >= slot.sent_us + slot.response_us))
+            {
+                try self.finish(slot, &.{}, TcpError.TcpTimeout);
+                if (self.rtu_framing)
+                {
+                    // a late partial frame would confuse the next one
+                    self.rx_len = 0;
+                }
+            }
+        }
+    }
+
+    //*************************************************************************
+    // a finished request, call release when done with it
+    pub fn next_done(self: *tcp_t) ?*tcp_slot_t
+    {
+        for (&self.slots) |*slot|
+        {
+            if (slot.used and slot.done)
+            {
+                return slot;
+            }
+        }
+        return null;
+    }
+
+    //*************************************************************************
+    pub fn release(_: *tcp_t, slot: *tcp_slot_t) void
+    {
+        slot.* = .{};
+    }
+};
+
+// test helpers, a tcp_t on one end of a socket pair, the test is the
+// gateway on the other end
+const test_util = if (builtin.is_test) struct
+{
+    const link_t = struct
+    {
+        tcp: tcp_t = .{},
+        peer: i32 = -1,
+
+        //*********************************************************************
+        fn init(self: *link_t, rtu_framing: bool,
+                max_inflight: usize) !void
+        {
+            var fds: [2]i32 = undefined;
+            const rv = std.os.linux.socketpair(std.os.linux.AF.UNIX,
+                    posix.SOCK.STREAM | posix.SOCK.NONBLOCK, 0, &fds);
+            if (rv != 0)
+            {
+                return error.SocketpairFailed;
+            }
+            self.tcp = .{.rtu_framing = rtu_framing, .fd = fds[0],
+                    .max_inflight = max_inflight};
+            self.peer = fds[1];
+        }
+
+        //*********************************************************************
+        fn deinit(self: *link_t) void
+        {
+            self.tcp.close();
+            posix.close(self.peer);
+        }
+
+        //*********************************************************************
+        // what the tcp_t sent, all of it is in the socket already
+        fn take(self: *link_t, buf: []u8) ![]u8
+        {
+            const len = try posix.read(self.peer, buf);
+            return buf[0..len];
+        }
+
+        //*********************************************************************
+        fn give(self: *link_t, data: []const u8) !void
+        {
+            _ = try posix.write(self.peer, data);
+            try self.tcp.on_readable();
+        }
+    };
+} else struct {};
+
+//*****************************************************************************
+test "mbap framing, out of order and split responses by tid"
+{
+    var link: test_util.link_t = .{};
+    try link.init(false, 2);
+    defer link.deinit();
+    try link.tcp.start(1, &.{0x03, 0x00, 0x10, 0x00, 0x01}, 100, 0);
+    try link.tcp.start(2, &.{0x04, 0x00, 0x20, 0x00, 0x01}, 200, 0);
+    try std.testing.expect(!link.tcp.can_start());
+    try std.testing.expectError(TcpError.TcpBusy,
+            link.tcp.start(3, &.{0x03, 0, 0, 0, 1}, 300, 0));
+    var buf: [64]u8 = undefined;
+    try std.testing.expectEqualSlices(u8, &.{
+            0, 0, 0, 0, 0, 6, 1, 0x03, 0x00, 0x10, 0x00, 0x01,
+            0, 1, 0, 0, 0, 6, 2, 0x04, 0x00, 0x20, 0x00, 0x01},
+            try link.take(&buf));
+    // tid 1 first, split in the mbap header, then an unknown tid
+    try link.give(&.{0, 1, 0, 0});
+    try std.testing.expect(link.tcp.next_done() == null);
+    try link.give(&.{0, 5, 2, 0x04, 0x02, 0x00, 0x2A});
+    try link.give(&.{0, 9, 0, 0, 0, 5, 1, 0x03, 0x02, 0x00, 0x01});
+    const first = link.tcp.next_done().?;
+    try std.testing.expectEqual(@as(usize, 200), first.key);
+    try std.testing.expectEqual(@as(?TcpError, null), first.err);
+    try std.testing.expectEqualSlices(u8, &.{0x04, 0x02, 0x00, 0x2A},
+            first.pdu());
+    link.tcp.release(first);
+    try std.testing.expect(link.tcp.next_done() == null);
+    try std.testing.expect(link.tcp.can_start());
+    // tid 0 answered by the wrong unit
+    try link.give(&.{0, 0, 0, 0, 0, 5, 7, 0x03, 0x02, 0x00, 0x01});
+    const second = link.tcp.next_done().?;
+    try std.testing.expectEqual(@as(usize, 100), second.key);
+    try std.testing.expectEqual(@as(?TcpError, TcpError.TcpBadResponse),
+            second.err);
+    link.tcp.release(second);
+    try std.testing.expectEqual(@as(usize, 0), link.tcp.rx_len);
+}
+
+//*****************************************************************************
+test "mbap exception and timeout"
+{
+    var link: test_util.link_t = .{};
+    try link.init(false, 2);
+    defer link.deinit();
+    link.tcp.response_us = 1000;
+    try link.tcp.start(1, &.{0x06, 0x00, 0x01, 0x00, 0x02}, 1, 0);
+    try link.tcp.start(1, &.{0x03, 0x00, 0x01, 0x00, 0x01}, 2, 500);
+    try link.give(&.{0, 0, 0, 0, 0, 3, 1, 0x86, 0x02});
+    const slot = link.tcp.next_done().?;
+    try std.testing.expectEqual(@as(?TcpError, TcpError.TcpException),
+            slot.err);
+    link.tcp.release(slot);
+    try link.tcp.check(1499);
+    try std.testing.expect(link.tcp.next_done() == null);
+    try link.tcp.check(1500);
+    const late = link.tcp.next_done().?;
+    try std.testing.expectEqual(@as(usize, 2), late.key);
+    try std.testing.expectEqual(@as(?TcpError, TcpError.TcpTimeout),
+            late.err);
+    link.tcp.release(late);
+    // the answer after the timeout is dropped
+    try link.give(&.{0, 1, 0, 0, 0, 5, 1, 0x03, 0x02, 0x00, 0x01});
+    try std.testing.expect(link.tcp.next_done() == null);
+}
+
+//*****************************************************************************
+test "rtu over tcp framing and crc"
+{
+    var link: test_util.link_t = .{};
+    try link.init(true, 1);
+    defer link.deinit();
+    try link.tcp.start(5, &.{0x03, 0x00, 0x00, 0x00, 0x0A}, 1, 0);
+    var buf: [64]u8 = undefined;
+    const request = try link.take(&buf);
+    try std.testing.expectEqual(@as(usize, 8), request.len);
+    try std.testing.expectEqual(@as(u8, 5), request[0]);
+    try std.testing.expectEqual(rtu.crc16(request[0..6]),
+            std.mem.readInt(u16, request[6..8], .little));
+    var rsp = [_]u8{5, 0x03, 0x02, 0x12, 0x34, 0, 0};
+    std.mem.writeInt(u16, rsp[5..7], rtu.crc16(rsp[0..5]), .little);
+    try link.give(rsp[0..2]);
+    try std.testing.expect(link.tcp.next_done() == null);
+    try link.give(rsp[2..]);
+    const slot = link.tcp.next_done().?;
+    try std.testing.expectEqual(@as(?TcpError, null), slot.err);
+    try std.testing.expectEqualSlices(u8, &.{0x03, 0x02, 0x12, 0x34},
+            slot.pdu());
+    link.tcp.release(slot);
+    // one bit flipped
+    try link.tcp.start(5, &.{0x03, 0x00, 0x00, 0x00, 0x0A}, 2, 0);
+    _ = try link.take(&buf);
+    rsp[3] ^= 1;
+    try link.give(&rsp);
+    const bad = link.tcp.next_done().?;
+    try std.testing.expectEqual(@as(?TcpError, TcpError.TcpCrcError),
+            bad.err);
+    link.tcp.release(bad);
+}
@@ -2,6 +2,8 @@ const std = @import("std");
 const builtin = @import("builtin");
 const log = @import("log");
 const tty = @import("tty_reader.zig");
+const plan = @import("tty_plan.zig");
+const tty_bus = @import("tty_bus.zig");
 const c = @cImport(
 {
     @cInclude("toml.h");
@@ -12,6 +14,9 @@ pub const TomlError = error
     FileSizeChanged,
     TomlParseFailed,
     TomlTableInFailed,
+    TomlBlockInvalid,
+    TomlBusInvalid,
+    TomlIdInvalid,
 };
 
 var g_allocator: *const std.mem.Allocator = undefined;
@@ -90,6 +95,781 @@ export fn my_toml_free(ptr: ?*anyopaque) void
 }
 
 //*****************************************************************************
+// toml double or int as f64
+fn toml_number_in(table: *c.toml_table_t, key: [*c]const u8) ?f64
+{
+    const dval = c.toml_double_in(table, key);
+    if (dval.ok != 0)
+    {
+        return dval.u.d;
+    }
+    const ival = c.toml_int_in(table, key);
+    if (ival.ok != 0)
+    {
+        return @floatFromInt(ival.u.i);
+    }
+    return null;
+}
+
+//*****************************************************************************
+// one number for every register, or an array with one for each of the
+// first registers, returns the array length, 0 for one number
+fn toml_numbers_in(table: *c.toml_table_t, key: [*c]const u8,
+        out: []f32) !usize
+{
+    if (toml_number_in(table, key)) |aval|
+    {
+        @memset(out, @floatCast(aval));
+        return 0;
+    }
+    const array = c.toml_array_in(table, key);
+    try err_if(array == null, TomlError.TomlBlockInvalid);
+    const count = c.toml_array_nelem(array);
+    try err_if((count < 0) or (count > out.len), TomlError.TomlBlockInvalid);
+    var index: c_int = 0;
+    while (index < count) : (index += 1)
+    {
+        const dval = c.toml_double_at(array, index);
+        const ival = c.toml_int_at(array, index);
+        if (dval.ok != 0)
+        {
+            out[@intCast(index)] = @floatCast(dval.u.d);
+        }
+        else if (ival.ok != 0)
+        {
+            out[@intCast(index)] = @floatFromInt(ival.u.i);
+        }
+        else
+        {
+            return TomlError.TomlBlockInvalid;
+        }
+    }
+    return @intCast(count);
+}
+
+//*****************************************************************************
+fn append_block(item: *tty.tty_id_info_t, reg_type: u8, address: u16,
+        count: u16) !?*tty.tty_block_info_t
+{
+    if (count < 1)
+    {
+        return null;
+    }
+    try err_if(count > plan.g_max_read_count, TomlError.TomlBlockInvalid);
+    try err_if(@as(u32, address) + count > 0x10000,
+            TomlError.TomlBlockInvalid);
+    const block = try item.blocks.addOne(g_allocator.*);
+    block.* = .{.reg_type = reg_type, .address = address, .count = count};
+    return block;
+}
+
+//*****************************************************************************
+// [[idN.block]] tables, type is "holding" or "input"
+fn setup_block(item: *tty.tty_id_info_t, btable: *c.toml_table_t) !void
+{
+    var reg_type: u8 = tty.g_reg_type_holding;
+    var address: u16 = 0;
+    var count: u16 = 0;
+    var interval_mstime: ?i64 = null;
+    var priority: ?u8 = null;
+    var align_to_clock: ?bool = null;
+    var deadline_mstime: ?i64 = null;
+    var static = false;
+    var adaptive = false;
+    var adapt: tty.tty_adapt_info_t = .{};
+    var deadband = false;
+    var keyframe_cycles: u32 = (tty.tty_deadband_info_t{}).keyframe_cycles;
+    var absolute = [_]f32{0.0} ** plan.g_max_read_count;
+    var percent = [_]f32{0.0} ** plan.g_max_read_count;
+    var deadband_len: usize = 0; // longest array, must fit in count
+    var bindex: c_int = 0;
+    while (c.toml_key_in(btable, bindex)) |abkey| : (bindex += 1)
+    {
+        const abkey_slice = std.mem.sliceTo(abkey, 0);
+        if (std.mem.eql(u8, abkey_slice, "type"))
+        {
+            const val = c.toml_string_in(btable, abkey_slice);
+            if (val.ok != 0)
+            {
+                const type_slice = std.mem.sliceTo(val.u.s, 0);
+                defer std.c.free(val.u.s);
+                if (std.mem.eql(u8, type_slice, "holding"))
+                {
+                    reg_type = tty.g_reg_type_holding;
+                }
+                else if (std.mem.eql(u8, type_slice, "input"))
+                {
+                    reg_type = tty.g_reg_type_input;
+                }
+                else
+                {
+                    try log.logln(log.LogLevel.info, @src(),
+                            "unknown block type [{s}] for id {}",
+                            .{type_slice, item.id});
+                    return TomlError.TomlBlockInvalid;
+                }
+            }
+        }
+        else if (std.mem.eql(u8, abkey_slice, "address"))
+        {
+            const val = c.toml_int_in(btable, abkey_slice);
+            address = if (val.ok != 0) @intCast(val.u.i) else 0;
+        }
+        else if (std.mem.eql(u8, abkey_slice, "count"))
+        {
+            const val = c.toml_int_in(btable, abkey_slice);
+            count = if (val.ok != 0) @intCast(val.u.i) else 0;
+        }
+        else if (std.mem.eql(u8, abkey_slice, "interval_mstime"))
+        {
+            const val = c.toml_int_in(btable, abkey_slice);
+            interval_mstime = if (val.ok != 0) val.u.i else null;
+        }
+        else if (std.mem.eql(u8, abkey_slice, "priority"))
+        {
+            const val = c.toml_int_in(btable, abkey_slice);
+            priority = if (val.ok != 0) @intCast(val.u.i) else null;
+        }
+        else if (std.mem.eql(u8, abkey_slice, "align_to_clock"))
+        {
+            const val = c.toml_bool_in(btable, abkey_slice);
+            align_to_clock = if (val.ok != 0) val.u.b != 0 else null;
+        }
+        else if (std.mem.eql(u8, abkey_slice, "deadline_mstime"))
+        {
+            const val = c.toml_int_in(btable, abkey_slice);
+            deadline_mstime = if (val.ok != 0) val.u.i else null;
+        }
+        else if (std.mem.eql(u8, abkey_slice, "static"))
+        {
+            const val = c.toml_bool_in(btable, abkey_slice);
+            static = (val.ok != 0) and (val.u.b != 0);
+        }
+        else if (std.mem.eql(u8, abkey_slice, "adaptive"))
+        {
+            const val = c.toml_bool_in(btable, abkey_slice);
+            adaptive = (val.ok != 0) and (val.u.b != 0);
+        }
+        else if (std.mem.eql(u8, abkey_slice, "min_interval_mstime"))
+        {
+            const val = c.toml_int_in(btable, abkey_slice);
+            if (val.ok != 0)
+            {
+                adapt.min_interval_mstime = val.u.i;
+            }
+        }
+        else if (std.mem.eql(u8, abkey_slice, "max_interval_mstime"))
+        {
+            const val = c.toml_int_in(btable, abkey_slice);
+            if (val.ok != 0)
+            {
+                adapt.max_interval_mstime = val.u.i;
+            }
+        }
+        else if (std.mem.eql(u8, abkey_slice, "watch_offset"))
+        {
+            const val = c.toml_int_in(btable, abkey_slice);
+            if (val.ok != 0)
+            {
+                adapt.watch_offset = @intCast(val.u.i);
+            }
+        }
+        else if (std.mem.eql(u8, abkey_slice, "watch_scale"))
+        {
+            adapt.watch_scale = toml_number_in(btable, abkey) orelse
+                    adapt.watch_scale;
+        }
+        else if (std.mem.eql(u8, abkey_slice, "watch_threshold"))
+        {
+            adapt.watch_threshold = toml_number_in(btable, abkey);
+        }
+        else if (std.mem.eql(u8, abkey_slice, "watch_band"))
+        {
+            adapt.watch_band = toml_number_in(btable, abkey) orelse
+                    adapt.watch_band;
+        }
+        else if (std.mem.eql(u8, abkey_slice, "rate_threshold"))
+        {
+            adapt.rate_threshold = toml_number_in(btable, abkey) orelse
+                    adapt.rate_threshold;
+        }
+        else if (std.mem.eql(u8, abkey_slice, "deadband"))
+        {
+            deadband = true;
+            deadband_len = @max(deadband_len,
+                    try toml_numbers_in(btable, abkey, &absolute));
+        }
+        else if (std.mem.eql(u8, abkey_slice, "deadband_percent"))
+        {
+            deadband = true;
+            deadband_len = @max(deadband_len,
+                    try toml_numbers_in(btable, abkey, &percent));
+        }
+        else if (std.mem.eql(u8, abkey_slice, "keyframe_cycles"))
+        {
+            const val = c.toml_int_in(btable, abkey_slice);
+            if (val.ok != 0)
+            {
+                deadband = true;
+                keyframe_cycles = @intCast(val.u.i);
+            }
+        }
+    }
+    try err_if(deadband and (deadband_len > count),
+            TomlError.TomlBlockInvalid);
+    if (adaptive)
+    {
+        // static blocks are not polled, nothing to adapt
+        try err_if(static, TomlError.TomlBlockInvalid);
+        try err_if(adapt.watch_offset >= count, TomlError.TomlBlockInvalid);
+        try err_if(adapt.watch_scale == 0.0, TomlError.TomlBlockInvalid);
+        try err_if(adapt.min_interval_mstime < 1,
+                TomlError.TomlBlockInvalid);
+    }
+    const block = try append_block(item, reg_type, address, count);
+    if (block) |ablock|
+    {
+        ablock.interval_mstime = interval_mstime;
+        ablock.priority = priority;
+        ablock.align_to_clock = align_to_clock;
+        ablock.deadline_mstime = deadline_mstime;
+        ablock.static = static;
+        ablock.adapt = if (adaptive) adapt else null;
+        if (deadband)
+        {
+            var info: tty.tty_deadband_info_t = .{
+                    .keyframe_cycles = keyframe_cycles};
+            errdefer info.deinit();
+            info.absolute = try g_allocator.dupe(f32, absolute[0..count]);
+            info.percent = try g_allocator.dupe(f32, percent[0..count]);
+            info.last = try g_allocator.alloc(u16, count);
+            ablock.deadband = info;
+        }
+    }
+}
+
+//*****************************************************************************
+// keys shared by [main] and [busN], returns false if key is not one of them
+fn setup_bus_config(config: *tty_bus.tty_bus_config_t,
+        ltable: *c.toml_table_t, alkey: [*c]const u8) !bool
+{
+    const alkey_slice = std.mem.sliceTo(alkey, 0);
+    if (std.mem.eql(u8, alkey_slice, "type"))
+    {
+        const val = c.toml_string_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            const type_slice = std.mem.sliceTo(val.u.s, 0);
+            defer std.c.free(val.u.s);
+            if (std.mem.eql(u8, type_slice, "rtu"))
+            {
+                config.bus_type = .Rtu;
+            }
+            else if (std.mem.eql(u8, type_slice, "tcp"))
+            {
+                config.bus_type = .Tcp;
+            }
+            else if (std.mem.eql(u8, type_slice, "rtutcp"))
+            {
+                config.bus_type = .RtuTcp;
+            }
+            else
+            {
+                try log.logln(log.LogLevel.info, @src(),
+                        "unknown bus type [{s}]", .{type_slice});
+                return TomlError.TomlBusInvalid;
+            }
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "host"))
+    {
+        const val = c.toml_string_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            @memset(&config.host, 0);
+            std.mem.copyForwards(u8, &config.host,
+                    std.mem.sliceTo(val.u.s, 0));
+            std.c.free(val.u.s);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "port"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.port = @intCast(val.u.i);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "max_inflight"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.max_inflight = @intCast(val.u.i);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "tty"))
+    {
+        const val = c.toml_string_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            @memset(&config.tty, 0);
+            std.mem.copyForwards(u8, &config.tty,
+                    std.mem.sliceTo(val.u.s, 0));
+            std.c.free(val.u.s);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "baud"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.baud = @intCast(val.u.i);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "parity"))
+    {
+        const val = c.toml_string_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            const parity_slice = std.mem.sliceTo(val.u.s, 0);
+            defer std.c.free(val.u.s);
+            try err_if(parity_slice.len != 1, TomlError.TomlBusInvalid);
+            config.parity = parity_slice[0];
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "data_bits"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.data_bits = @intCast(val.u.i);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "stop_bits"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.stop_bits = @intCast(val.u.i);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "modbus_debug"))
+    {
+        const val = c.toml_bool_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.modbus_debug = val.u.b != 0;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "sniff"))
+    {
+        const val = c.toml_bool_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.sniff = val.u.b != 0;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "item_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.item_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "list_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.list_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "merge_gap"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.merge_gap = @intCast(val.u.i);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "response_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.response_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "adaptive_response"))
+    {
+        const val = c.toml_bool_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.adaptive_response = val.u.b != 0;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "response_floor_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.response_floor_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "gap_floor_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.gap_floor_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "breaker_timeouts"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.breaker_timeouts = @intCast(val.u.i);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "breaker_min_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.breaker_min_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "breaker_max_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.breaker_max_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "starve_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.starve_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "request_deadline_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.request_deadline_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "align_to_clock"))
+    {
+        const val = c.toml_bool_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.align_to_clock = val.u.b != 0;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "align_offset_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.align_offset_mstime = val.u.i;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "warm_polling"))
+    {
+        const val = c.toml_bool_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.warm_polling = val.u.b != 0;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "low_latency"))
+    {
+        const val = c.toml_bool_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.low_latency = val.u.b != 0;
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "latency_timer_mstime"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.latency_timer_mstime = @intCast(val.u.i);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "rt_priority"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.rt_priority = @intCast(val.u.i);
+        }
+    }
+    else if (std.mem.eql(u8, alkey_slice, "cpu_affinity"))
+    {
+        const val = c.toml_int_in(ltable, alkey_slice);
+        if (val.ok != 0)
+        {
+            config.cpu_affinity = @intCast(val.u.i);
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+//*****************************************************************************
+fn setup_main(info: *tty.tty_info_t, ltable: *c.toml_table_t) !void
+{
+    var lindex: c_int = 0;
+    while (c.toml_key_in(ltable, lindex)) |alkey| : (lindex += 1)
+    {
+        if (try setup_bus_config(&info.defaults, ltable, alkey))
+        {
+            continue;
+        }
+        const alkey_slice = std.mem.sliceTo(alkey, 0);
+        if (std.mem.eql(u8, alkey_slice, "listen_socket"))
+        {
+            const val = c.toml_string_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                @memset(&info.listen_socket, 0);
+                std.mem.copyForwards(u8, &info.listen_socket,
+                        std.mem.sliceTo(val.u.s, 0));
+                std.c.free(val.u.s);
+            }
+        }
+        else if (std.mem.eql(u8, alkey_slice, "mlockall"))
+        {
+            const val = c.toml_bool_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                info.mlockall = val.u.b != 0;
+            }
+        }
+    }
+}
+
+//*****************************************************************************
+// [busN] starts from the [main] settings
+fn setup_bus(info: *tty.tty_info_t, bus_num: u8,
+        ltable: *c.toml_table_t) !void
+{
+    try err_if(info.get_bus(bus_num) != null, TomlError.TomlBusInvalid);
+    const bus = try tty_bus.tty_bus_info_t.create(g_allocator.*, info,
+            bus_num, &info.defaults);
+    errdefer bus.delete();
+    var lindex: c_int = 0;
+    while (c.toml_key_in(ltable, lindex)) |alkey| : (lindex += 1)
+    {
+        if (!try setup_bus_config(&bus.config, ltable, alkey))
+        {
+            try log.logln(log.LogLevel.info, @src(),
+                    "unknown key [{s}] for bus {}",
+                    .{std.mem.sliceTo(alkey, 0), bus_num});
+        }
+    }
+    if (bus.config.bus_type == .Rtu)
+    {
+        try err_if(bus.config.tty[0] == 0, TomlError.TomlBusInvalid);
+    }
+    else
+    {
+        try err_if(bus.config.host[0] == 0, TomlError.TomlBusInvalid);
+        // only a serial line can be listened to
+        try err_if(bus.config.sniff, TomlError.TomlBusInvalid);
+    }
+    try info.bus_list.append(g_allocator.*, bus);
+}
+
+//*****************************************************************************
+fn setup_id(info: *tty.tty_info_t, id: u8, ltable: *c.toml_table_t) !void
+{
+    var item: tty.tty_id_info_t = .{};
+    errdefer item.deinit();
+    item.id = id;
+    var bus_num: u8 = 0;
+    // single holding and input block, older configs
+    var read_address: u16 = 0;
+    var read_count: u16 = 0;
+    var read_input_address: u16 = 0;
+    var read_input_count: u16 = 0;
+    var lindex: c_int = 0;
+    while (c.toml_key_in(ltable, lindex)) |alkey| : (lindex += 1)
+    {
+        const alkey_slice = std.mem.sliceTo(alkey, 0);
+        if (std.mem.eql(u8, alkey_slice, "read_address"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            read_address = if (val.ok != 0) @intCast(val.u.i) else 0;
+        }
+        else if (std.mem.eql(u8, alkey_slice, "read_count"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            read_count = if (val.ok != 0) @intCast(val.u.i) else 0;
+        }
+        else if (std.mem.eql(u8, alkey_slice, "read_input_address"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            read_input_address = if (val.ok != 0) @intCast(val.u.i) else 0;
+        }
+        else if (std.mem.eql(u8, alkey_slice, "read_input_count"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            read_input_count = if (val.ok != 0) @intCast(val.u.i) else 0;
+        }
+        else if (std.mem.eql(u8, alkey_slice, "bus"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                bus_num = @intCast(val.u.i);
+            }
+        }
+        else if (std.mem.eql(u8, alkey_slice, "merge_gap"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                item.merge_gap = @intCast(val.u.i);
+            }
+        }
+        else if (std.mem.eql(u8, alkey_slice, "interval_mstime"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                item.interval_mstime = val.u.i;
+            }
+        }
+        else if (std.mem.eql(u8, alkey_slice, "priority"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                item.priority = @intCast(val.u.i);
+            }
+        }
+        else if (std.mem.eql(u8, alkey_slice, "align_to_clock"))
+        {
+            const val = c.toml_bool_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                item.align_to_clock = val.u.b != 0;
+            }
+        }
+        else if (std.mem.eql(u8, alkey_slice, "deadline_mstime"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                item.deadline_mstime = val.u.i;
+            }
+        }
+        else if (std.mem.eql(u8, alkey_slice, "write_read"))
+        {
+            const val = c.toml_bool_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                item.write_read = val.u.b != 0;
+            }
+        }
+        else if (std.mem.eql(u8, alkey_slice, "baud_register"))
+        {
+            const val = c.toml_int_in(ltable, alkey_slice);
+            if (val.ok != 0)
+            {
+                item.baud_register = @intCast(val.u.i);
+            }
+        }
+        else if (std.mem.eql(u8, alkey_slice, "baud_rates"))
+        {
+            // index is the code written to baud_register
+            const barray = c.toml_array_in(ltable, alkey_slice);
+            try err_if(barray == null, TomlError.TomlTableInFailed);
+            const bcount = c.toml_array_nelem(barray);
+            try err_if(bcount > item.baud_rates.len, TomlError.TomlIdInvalid);
+            var bindex: c_int = 0;
+            while (bindex < bcount) : (bindex += 1)
+            {
+                const val = c.toml_int_at(barray, bindex);
+                try err_if(val.ok == 0, TomlError.TomlIdInvalid);
+                item.baud_rates[@intCast(bindex)] = @intCast(val.u.i);
+            }
+            item.baud_rates_count = @intCast(bcount);
+        }
+        else if (std.mem.eql(u8, alkey_slice, "block"))
+        {
+            const barray = c.toml_array_in(ltable, alkey_slice);
+            try err_if(barray == null, TomlError.TomlTableInFailed);
+            const bcount = c.toml_array_nelem(barray);
+            var bindex: c_int = 0;
+            while (bindex < bcount) : (bindex += 1)
+            {
+                const btable = c.toml_table_at(barray, bindex);
+                if (btable) |abtable|
+                {
+                    try setup_block(&item, abtable);
+                }
+            }
+        }
+    }
+    _ = try append_block(&item, tty.g_reg_type_holding,
+            read_address, read_count);
+    _ = try append_block(&item, tty.g_reg_type_input,
+            read_input_address, read_input_count);
+    var bus = info.get_bus(bus_num);
+    if ((bus == null) and (bus_num == 0))
+    {
+        // configs without [busN] put everything on [main] tty
+        const bus0 = try tty_bus.tty_bus_info_t.create(g_allocator.*, info,
+                0, &info.defaults);
+        info.bus_list.append(g_allocator.*, bus0) catch |err|
+        {
+            bus0.delete();
+            return err;
+        };
+        bus = bus0;
+    }
+    if (bus) |abus|
+    {
+        try abus.id_list.append(g_allocator.*, item);
+        return;
+    }
+    try log.logln(log.LogLevel.info, @src(),
+            "id {} is on bus {} but there is no [bus{}]",
+            .{id, bus_num, bus_num});
+    return TomlError.TomlBusInvalid;
+}
+
+//*****************************************************************************
+// number after prefix in a table name like bus1 or id9, null if akey
+// does not start with prefix
+fn table_num(akey_slice: []const u8, prefix: []const u8) !?u8
+{
+    if ((akey_slice.len > prefix.len) and
+            std.mem.startsWith(u8, akey_slice, prefix))
+    {
+        return try std.fmt.parseInt(u8, akey_slice[prefix.len..], 10);
+    }
+    return null;
+}
+
+//*****************************************************************************
+// [main] first, it holds the defaults for each [busN], then the buses,
+// then the [idN] that go on them, key order in the file does not matter
 pub fn setup_tty_info(allocator: *const std.mem.Allocator,
         info: *tty.tty_info_t, config_file: []const u8) !void
 {
@@ -102,103 +882,31 @@ pub fn setup_tty_info(allocator: *const std.mem.Allocator,
     try log.logln(log.LogLevel.info, @src(),
             "load_tty_config ok for file [{s}]",
             .{config_file});
+    const ltable = c.toml_table_in(table, "main");
+    if (ltable) |altable|
+    {
+        try setup_main(info, altable);
+    }
     var index: c_int = 0;
     while (c.toml_key_in(table, index)) |akey| : (index += 1)
     {
         const akey_slice = std.mem.sliceTo(akey, 0);
-        if (std.mem.eql(u8, akey_slice, "main"))
+        if (try table_num(akey_slice, "bus")) |bus_num|
         {
-            const ltable = c.toml_table_in(table, akey);
-            try err_if(ltable == null, TomlError.TomlTableInFailed);
-            var lindex: c_int = 0;
-            while (c.toml_key_in(ltable, lindex)) |alkey| : (lindex += 1)
-            {
-                const alkey_slice = std.mem.sliceTo(alkey, 0);
-                if (std.mem.eql(u8, alkey_slice, "tty"))
-                {
-                    const val = c.toml_string_in(ltable, alkey_slice);
-                    if (val.ok != 0)
-                    {
-                        @memset(&info.tty, 0);
-                        std.mem.copyForwards(u8, &info.tty,
-                                std.mem.sliceTo(val.u.s, 0));
-                        std.c.free(val.u.s);
-                    }
-                }
-                else if (std.mem.eql(u8, alkey_slice, "modbus_debug"))
-                {
-                    const val = c.toml_bool_in(ltable, alkey_slice);
-                    if (val.ok != 0)
-                    {
-                        info.modbus_debug = val.u.b != 0;
-                    }
-                }
-                else if (std.mem.eql(u8, alkey_slice, "item_mstime"))
-                {
-                    const val = c.toml_int_in(ltable, alkey_slice);
-                    if (val.ok != 0)
-                    {
-                        info.item_mstime = val.u.i;
-                    }
-                }
-                else if (std.mem.eql(u8, alkey_slice, "list_mstime"))
-                {
-                    const val = c.toml_int_in(ltable, alkey_slice);
-                    if (val.ok != 0)
-                    {
-                        info.list_mstime = val.u.i;
-                    }
-                }
-                else if (std.mem.eql(u8, alkey_slice, "listen_socket"))
-                {
-                    const val = c.toml_string_in(ltable, alkey_slice);
-                    if (val.ok != 0)
-                    {
-                        @memset(&info.listen_socket, 0);
-                        std.mem.copyForwards(u8, &info.listen_socket,
-                                std.mem.sliceTo(val.u.s, 0));
-                        std.c.free(val.u.s);
-                    }
-                }
-            }
+            const btable = c.toml_table_in(table, akey);
+            try err_if(btable == null, TomlError.TomlTableInFailed);
+            try setup_bus(info, bus_num, btable.?);
         }
-        else if ((akey_slice.len > 1) and (akey_slice[0] == 'i') and
-                (akey_slice[1] == 'd'))
+    }
+    index = 0;
+    while (c.toml_key_in(table, index)) |akey| : (index += 1)
+    {
+        const akey_slice = std.mem.sliceTo(akey, 0);
+        if (try table_num(akey_slice, "id")) |id|
         {
-            var item: tty.tty_id_info_t = .{};
-            item.id = try std.fmt.parseInt(u8, akey_slice[2..], 10);
-            const ltable = c.toml_table_in(table, akey);
-            try err_if(ltable == null, TomlError.TomlTableInFailed);
-            var lindex: c_int = 0;
-            while (c.toml_key_in(ltable, lindex)) |alkey| : (lindex += 1)
-            {
-                const alkey_slice = std.mem.sliceTo(alkey, 0);
-                if (std.mem.eql(u8, alkey_slice, "read_address"))
-                {
-                    const val = c.toml_int_in(ltable, alkey_slice);
-                    item.read_address =
-                            if (val.ok != 0) @intCast(val.u.i) else 0;
-                }
-                else if (std.mem.eql(u8, alkey_slice, "read_count"))
-                {
-                    const val = c.toml_int_in(ltable, alkey_slice);
-                    item.read_count =
-                            if (val.ok != 0) @intCast(val.u.i) else 0;
-                }
-                else if (std.mem.eql(u8, alkey_slice, "read_input_address"))
-                {
-                    const val = c.toml_int_in(ltable, alkey_slice);
-                    item.read_input_address =
-                            if (val.ok != 0) @intCast(val.u.i) else 0;
-                }
-                else if (std.mem.eql(u8, alkey_slice, "read_input_count"))
-                {
-                    const val = c.toml_int_in(ltable, alkey_slice);
-                    item.read_input_count =
-                            if (val.ok != 0) @intCast(val.u.i) else 0;
-                }
-            }
-            try info.id_list.append(g_allocator.*, item);
+            const itable = c.toml_table_in(table, akey);
+            try err_if(itable == null, TomlError.TomlTableInFailed);
+            try setup_id(info, id, itable.?);
         }
     }
 }
@@ -0,0 +1,71 @@
+const std = @import("std");
+const linux = std.os.linux;
+const posix = std.posix;
+
+// sends queued in one pass are submitted with one io_uring_enter, the
+// socket flags keep a full socket from parking the send in the kernel,
+// every send queued is complete when submit_all returns, one sendmsg per
+// socket, a short send does not break a linked chain
+pub const g_entries: u16 = 64;
+const g_send_flags: u32 = posix.MSG.DONTWAIT | posix.MSG.NOSIGNAL;
+
+pub const uring_t = struct
+{
+    ring: linux.IoUring = undefined,
+
+    //*************************************************************************
+    // fails on kernels without io_uring or when it is disabled, the
+    // caller keeps its poll path
+    pub fn init(self: *uring_t) !void
+    {
+        self.ring = try linux.IoUring.init(g_entries, 0);
+    }
+
+    //*************************************************************************
+    pub fn deinit(self: *uring_t) void
+    {
+        self.ring.deinit();
+    }
+
+    //*************************************************************************
+    // msghdr and its iovecs must stay put until submit_all returns
+    pub fn queue_sendmsg(self: *uring_t, user_data: u64, fd: i32,
+            msghdr: *const posix.msghdr_const) !void
+    {
+        _ = try self.ring.sendmsg(user_data, fd, msghdr, g_send_flags);
+    }
+
+    //*************************************************************************
+    // one syscall for everything queued, returns a completion for each
+    pub fn submit_all(self: *uring_t,
+            cqes: *[g_entries]linux.io_uring_cqe) ![]linux.io_uring_cqe
+    {
+        const queued = self.ring.sq_ready();
+        if (queued < 1)
+        {
+            return cqes[0..0];
+        }
+        _ = try self.ring.submit_and_wait(queued);
+        var count: u32 = 0;
+        while (count < queued)
+        {
+            count += try self.ring.copy_cqes(cqes[count..queued],
+                    queued - count);
+        }
+        return cqes[0..count];
+    }
+};
+
+//*****************************************************************************
+pub fn set_iov(iov: *posix.iovec_const, data: []const u8) void
+{
+    // field names changed in zig 0.14
+    if (@hasField(posix.iovec_const, "base"))
+    {
+        iov.* = .{.base = data.ptr, .len = data.len};
+    }
+    else
+    {
+        iov.* = .{.iov_base = data.ptr, .iov_len = data.len};
+    }
+}